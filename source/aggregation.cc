@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <thread>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+#include "aggregation.h"
+
+/* Spins of `close` before yielding to a writer that may have been preempted mid-copy. */
+static const int close_spin_limit = 64;
+
+static const int64_t chunk_frames = VBAN_GROUP_CHUNK_FRAMES;
+static const int64_t ring_frames = VBAN_GROUP_CHUNK_FRAMES * VBAN_GROUP_N_CHUNKS;
+
+static inline int64_t floor_div(int64_t a, int64_t b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/* Process-wide list of the groups. */
+struct aggregation_registry
+{
+	static std::mutex mutex;
+	static std::map<uint32_t, std::weak_ptr<aggregation_group>> groups;
+	static std::atomic<uint32_t> last_member_id;
+};
+
+std::mutex aggregation_registry::mutex;
+std::map<uint32_t, std::weak_ptr<aggregation_group>> aggregation_registry::groups;
+std::atomic<uint32_t> aggregation_registry::last_member_id{0};
+
+aggregation_group::aggregation_group(uint32_t id_, double sample_rate_)
+	: id(id_), sample_rate(sample_rate_), chunks(new aggregation_chunk[VBAN_GROUP_N_CHUNKS])
+{
+	for (uint32_t i = 0; i < VBAN_GROUP_N_CHUNKS; i++) {
+		chunks[i].position.store(aggregation_chunk::closed, std::memory_order_relaxed);
+		chunks[i].writers.store(0, std::memory_order_relaxed);
+		chunks[i].channel_mask.store(0, std::memory_order_relaxed);
+	}
+}
+
+void aggregation_group::update_members()
+{
+	uint32_t n = 0;
+	uint64_t mask = 0;
+	for (auto &m : members) {
+		n = std::max(n, m.offset + m.n_channels);
+		for (uint32_t ch = m.offset; ch < m.offset + m.n_channels; ch++)
+			mask |= 1ULL << ch;
+	}
+	n_channels.store(n, std::memory_order_release);
+	channel_mask.store(mask, std::memory_order_release);
+
+	bool has_leader = false;
+	for (auto &m : members)
+		has_leader = has_leader || m.id == leader_id.load(std::memory_order_relaxed);
+	if (!has_leader)
+		leader_id.store(members.size() ? members[0].id : 0, std::memory_order_release);
+}
+
+aggregation_chunk &aggregation_group::chunk_at(int64_t position) noexcept
+{
+	int64_t i = floor_div(position, chunk_frames) % VBAN_GROUP_N_CHUNKS;
+	return chunks[i < 0 ? i + VBAN_GROUP_N_CHUNKS : i];
+}
+
+uint32_t aggregation_group::write(int64_t position, const float *const *planes, uint32_t offset,
+				  uint32_t n_ch, uint32_t n_frames) noexcept
+{
+	uint32_t n_dropped = 0;
+	n_ch = std::min<uint32_t>(n_ch, VBAN_GROUP_MAX_CHANNELS - std::min<uint32_t>(offset, VBAN_GROUP_MAX_CHANNELS));
+
+	uint32_t done = 0;
+	while (done < n_frames) {
+		int64_t pos = position + done;
+		int64_t start = floor_div(pos, chunk_frames) * chunk_frames;
+		uint32_t in_chunk = (uint32_t)(pos - start);
+		uint32_t n = std::min<uint32_t>(n_frames - done, (uint32_t)chunk_frames - in_chunk);
+
+		aggregation_chunk &c = chunk_at(pos);
+		c.writers.fetch_add(1);
+		if (c.position.load() == start) {
+			uint64_t mask = 0;
+			for (uint32_t ch = 0; ch < n_ch; ch++) {
+				if (planes[ch])
+					memcpy(&c.data[offset + ch][in_chunk], planes[ch] + done, n * sizeof(float));
+				mask |= 1ULL << (offset + ch);
+			}
+			c.channel_mask.fetch_or(mask, std::memory_order_relaxed);
+		} else {
+			n_dropped += n;
+		}
+		c.writers.fetch_sub(1);
+
+		done += n;
+	}
+
+	return n_dropped;
+}
+
+/* Stops new writers and waits for the ones copying into the chunk. */
+void aggregation_group::close(aggregation_chunk &c) noexcept
+{
+	c.position.store(aggregation_chunk::closed);
+	for (int i = 0; c.writers.load(); i++) {
+		if (i < close_spin_limit)
+			cpu_relax();
+		else
+			std::this_thread::yield();
+	}
+}
+
+void aggregation_group::arm(int64_t position) noexcept
+{
+	int64_t start = floor_div(position, chunk_frames) * chunk_frames;
+	for (int64_t pos = start; pos < start + ring_frames; pos += chunk_frames) {
+		aggregation_chunk &c = chunk_at(pos);
+		close(c);
+		memset(c.data, 0, sizeof(c.data));
+		c.channel_mask.store(0, std::memory_order_relaxed);
+		c.position.store(pos);
+	}
+}
+
+uint64_t aggregation_group::read(int64_t position, uint32_t n_ch, float *dst) noexcept
+{
+	aggregation_chunk &c = chunk_at(position);
+	close(c);
+
+	n_ch = std::min<uint32_t>(n_ch, VBAN_GROUP_MAX_CHANNELS);
+	for (uint32_t i = 0; i < (uint32_t)chunk_frames; i++) {
+		for (uint32_t ch = 0; ch < n_ch; ch++)
+			*dst++ = c.data[ch][i];
+	}
+	uint64_t mask = c.channel_mask.load(std::memory_order_relaxed);
+
+	/* Members write only below `n_channels`, the leader restarts and arms the ring when it grows. */
+	for (uint32_t ch = 0; ch < n_ch; ch++)
+		memset(c.data[ch], 0, sizeof(c.data[ch]));
+	c.channel_mask.store(0, std::memory_order_relaxed);
+	c.position.store(position + ring_frames);
+
+	return mask;
+}
+
+aggregation_membership::aggregation_membership() : id(++aggregation_registry::last_member_id) {}
+
+aggregation_membership::~aggregation_membership()
+{
+	leave();
+}
+
+bool aggregation_membership::update(uint32_t group_id, uint32_t offset_, uint32_t n_channels_, double sample_rate)
+{
+	if (!group_id) {
+		leave();
+		return true;
+	}
+
+	if (joined && joined->id == group_id && joined->sample_rate == sample_rate && offset == offset_ &&
+	    n_channels == n_channels_)
+		return true;
+
+	leave();
+
+	if (offset_ + n_channels_ > VBAN_GROUP_MAX_CHANNELS) {
+		fprintf(stderr, "Error: Aggregation group %u has up to %d channels\n", group_id,
+			VBAN_GROUP_MAX_CHANNELS);
+		return false;
+	}
+
+	std::unique_lock lk(aggregation_registry::mutex);
+	std::shared_ptr<aggregation_group> g = aggregation_registry::groups[group_id].lock();
+	if (!g) {
+		g = std::make_shared<aggregation_group>(group_id, sample_rate);
+		aggregation_registry::groups[group_id] = g;
+	} else if (g->sample_rate != sample_rate) {
+		fprintf(stderr, "Error: Aggregation group %u runs at %.0f Hz, cannot join at %.0f Hz\n", group_id,
+			g->sample_rate, sample_rate);
+		return false;
+	}
+
+	g->members.push_back({id, offset_, n_channels_});
+	g->update_members();
+
+	joined = g;
+	offset = offset_;
+	n_channels = n_channels_;
+	return true;
+}
+
+void aggregation_membership::leave()
+{
+	if (!joined)
+		return;
+
+	std::unique_lock lk(aggregation_registry::mutex);
+	auto &members = joined->members;
+	for (auto it = members.begin(); it != members.end(); ++it) {
+		if (it->id == id) {
+			members.erase(it);
+			break;
+		}
+	}
+	joined->update_members();
+	joined.reset();
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* Aggregation of several plugin instances in the process into one VBAN stream.
+ *
+ * Instances join a numbered group with the channel offset where their VBAN
+ * channels go in the group stream. Each member writes its audio from its own
+ * sender thread into a ring of chunks shared by the group, at the position of
+ * the audio on the host's continuous timeline. The first member to join is
+ * the leader; its sender thread reads the chunks once every member had the
+ * time to write them and sends the group stream.
+ *
+ * The leader arms each chunk for one position and clears it before arming it
+ * for the next lap. A member writing to a chunk armed for another position,
+ * because it is late or far ahead, is dropped, so the channels of that member
+ * are silent in the chunk. Nothing blocks the audio threads; the leader only
+ * waits for members that are in the middle of copying into the chunk it
+ * reads. */
+
+#define VBAN_GROUP_MAX 16
+#define VBAN_GROUP_MAX_CHANNELS 64
+#define VBAN_GROUP_CHUNK_FRAMES 128
+#define VBAN_GROUP_N_CHUNKS 32 /* ~85 ms at 48 kHz */
+
+struct aggregation_chunk
+{
+	std::atomic<int64_t> position; /* first frame, or `closed` while the leader reads it */
+	std::atomic<uint32_t> writers;
+	std::atomic<uint64_t> channel_mask; /* channels written */
+	float data[VBAN_GROUP_MAX_CHANNELS][VBAN_GROUP_CHUNK_FRAMES];
+
+	static const int64_t closed = INT64_MIN;
+};
+
+struct aggregation_group
+{
+	aggregation_group(uint32_t id, double sample_rate);
+
+	const uint32_t id;
+	const double sample_rate;
+
+	/* Member that sends the stream */
+	std::atomic<uint32_t> leader_id{0};
+	/* Channels of the group stream and the bit mask of the channels contributed by any member */
+	std::atomic<uint32_t> n_channels{0};
+	std::atomic<uint64_t> channel_mask{0};
+	/* End position written by the leader, members without the host timeline start from here */
+	std::atomic<int64_t> head{0};
+
+	/* Writes `n_frames` of planar audio into the channels from `offset`. A plane may be null
+	 * for silence. Returns the number of frames dropped for being outside the armed chunks. */
+	uint32_t write(int64_t position, const float *const *planes, uint32_t offset, uint32_t n_channels,
+		       uint32_t n_frames) noexcept;
+
+	/* For the leader: arms the ring for the chunks from `position`, aligned to a chunk. */
+	void arm(int64_t position) noexcept;
+
+	/* For the leader: interleaves the chunk at `position` into `dst` as `n_channels` channels,
+	 * then arms it for the next lap. Returns the bit mask of the channels written by members. */
+	uint64_t read(int64_t position, uint32_t n_channels, float *dst) noexcept;
+
+private:
+	friend struct aggregation_membership;
+
+	struct member
+	{
+		uint32_t id;
+		uint32_t offset;
+		uint32_t n_channels;
+	};
+	std::vector<member> members; /* guarded by the registry */
+	void update_members();
+
+	std::unique_ptr<aggregation_chunk[]> chunks;
+
+	aggregation_chunk &chunk_at(int64_t position) noexcept;
+	void close(aggregation_chunk &c) noexcept;
+};
+
+/* Membership of one plugin instance, used only by its sender thread. */
+struct aggregation_membership
+{
+	aggregation_membership();
+	~aggregation_membership();
+
+	/* Joins, leaves, or moves to another group. Group 0 leaves. Returns false if the group
+	 * cannot be joined. */
+	bool update(uint32_t group_id, uint32_t offset, uint32_t n_channels, double sample_rate);
+	void leave();
+
+	inline aggregation_group *group() const noexcept
+	{
+		return joined.get();
+	}
+	inline bool is_leader() const noexcept
+	{
+		return joined && joined->leader_id.load(std::memory_order_acquire) == id;
+	}
+
+private:
+	const uint32_t id;
+	uint32_t offset = 0;
+	uint32_t n_channels = 0;
+	std::shared_ptr<aggregation_group> joined;
+};
@@ -1,50 +1,293 @@
+#include <algorithm>
 #include <cstring>
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define AUDIO_BUFFER_USE_SSE
+#endif
 
 #include "audio_buffer.h"
+#include "trace.h"
 
-void audio_packet::copy_float(void **data_, uint32_t n_channels_, uint32_t n_samples_) noexcept
+static inline uint32_t popcount32(uint32_t x)
+{
+	x = x - ((x >> 1) & 0x55555555);
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	return (((x + (x >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+void audio_levels::reset() noexcept
+{
+	for (uint32_t i = 0; i < AUDIO_LEVELS_MAX_CHANNELS; i++) {
+		peak[i] = 0.0f;
+		sum_sq[i] = 0.0;
+	}
+	n_frames = 0;
+}
+
+#ifdef AUDIO_BUFFER_USE_SSE
+static inline __m128 abs_ps(__m128 x)
+{
+	return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+}
+#endif
+
+void audio_levels::measure(uint32_t i_channel, const float *src, uint32_t n) noexcept
+{
+	if (i_channel >= AUDIO_LEVELS_MAX_CHANNELS)
+		return;
+
+	uint32_t k = 0;
+	float p = 0.0f, s = 0.0f;
+#ifdef AUDIO_BUFFER_USE_SSE
+	const __m128 zero = _mm_setzero_ps();
+	__m128 p0 = zero, p1 = zero, s0 = zero, s1 = zero;
+	for (; k + 8 <= n; k += 8) {
+		__m128 x0 = _mm_loadu_ps(src + k);
+		__m128 x1 = _mm_loadu_ps(src + k + 4);
+		p0 = _mm_max_ps(p0, abs_ps(x0));
+		p1 = _mm_max_ps(p1, abs_ps(x1));
+		s0 = _mm_add_ps(s0, _mm_mul_ps(x0, x0));
+		s1 = _mm_add_ps(s1, _mm_mul_ps(x1, x1));
+	}
+	float pa[4], sa[4];
+	_mm_storeu_ps(pa, _mm_max_ps(p0, p1));
+	_mm_storeu_ps(sa, _mm_add_ps(s0, s1));
+	p = std::max(std::max(pa[0], pa[1]), std::max(pa[2], pa[3]));
+	s = (sa[0] + sa[1]) + (sa[2] + sa[3]);
+#endif
+	for (; k < n; k++) {
+		float x = src[k];
+		p = std::max(p, x < 0.0f ? -x : x);
+		s += x * x;
+	}
+	peak[i_channel] = std::max(peak[i_channel], p);
+	sum_sq[i_channel] += s;
+}
+
+/* Copies `n` samples, also to `through` if `THROUGH`, and measures them on the way,
+ * so each sample is read once. A 2 x 256 block takes 120-140 ns against 35-45 ns for a
+ * plain memcpy, about 3.5x; the loads are shared, the max and multiply-add are not. */
+template<bool THROUGH>
+static void copy_measure(float *dst, float *through, const float *src, uint32_t n, float &peak,
+			 double &sum_sq) noexcept
+{
+	uint32_t k = 0;
+	float p = 0.0f, s = 0.0f;
+#ifdef AUDIO_BUFFER_USE_SSE
+	/* Independent accumulators keep the additions from serializing the loop. */
+	const __m128 zero = _mm_setzero_ps();
+	__m128 p0 = zero, p1 = zero, s0 = zero, s1 = zero, s2 = zero, s3 = zero;
+	for (; k + 16 <= n; k += 16) {
+		__m128 x0 = _mm_loadu_ps(src + k);
+		__m128 x1 = _mm_loadu_ps(src + k + 4);
+		__m128 x2 = _mm_loadu_ps(src + k + 8);
+		__m128 x3 = _mm_loadu_ps(src + k + 12);
+		_mm_storeu_ps(dst + k, x0);
+		_mm_storeu_ps(dst + k + 4, x1);
+		_mm_storeu_ps(dst + k + 8, x2);
+		_mm_storeu_ps(dst + k + 12, x3);
+		if constexpr (THROUGH) {
+			_mm_storeu_ps(through + k, x0);
+			_mm_storeu_ps(through + k + 4, x1);
+			_mm_storeu_ps(through + k + 8, x2);
+			_mm_storeu_ps(through + k + 12, x3);
+		}
+		p0 = _mm_max_ps(p0, _mm_max_ps(abs_ps(x0), abs_ps(x1)));
+		p1 = _mm_max_ps(p1, _mm_max_ps(abs_ps(x2), abs_ps(x3)));
+		s0 = _mm_add_ps(s0, _mm_mul_ps(x0, x0));
+		s1 = _mm_add_ps(s1, _mm_mul_ps(x1, x1));
+		s2 = _mm_add_ps(s2, _mm_mul_ps(x2, x2));
+		s3 = _mm_add_ps(s3, _mm_mul_ps(x3, x3));
+	}
+	for (; k + 4 <= n; k += 4) {
+		__m128 x0 = _mm_loadu_ps(src + k);
+		_mm_storeu_ps(dst + k, x0);
+		if constexpr (THROUGH)
+			_mm_storeu_ps(through + k, x0);
+		p0 = _mm_max_ps(p0, abs_ps(x0));
+		s0 = _mm_add_ps(s0, _mm_mul_ps(x0, x0));
+	}
+	float pa[4], sa[4];
+	_mm_storeu_ps(pa, _mm_max_ps(p0, p1));
+	_mm_storeu_ps(sa, _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+	p = std::max(std::max(pa[0], pa[1]), std::max(pa[2], pa[3]));
+	s = (sa[0] + sa[1]) + (sa[2] + sa[3]);
+#endif
+	for (; k < n; k++) {
+		float x = src[k];
+		dst[k] = x;
+		if constexpr (THROUGH)
+			through[k] = x;
+		p = std::max(p, x < 0.0f ? -x : x);
+		s += x * x;
+	}
+	peak = std::max(peak, p);
+	sum_sq += s;
+}
+
+void audio_packet::copy_float(void **data_, uint32_t n_channels_, uint32_t channel_mask_, uint32_t n_samples_,
+			      audio_levels *levels, void **through) noexcept
 {
 	n_channels = n_channels_;
+	channel_mask = channel_mask_ & ((1u << n_channels_) - 1);
 	n_samples = n_samples_;
 
-	data.resize(sizeof(float) * n_channels_ * n_samples_);
+	data.resize(sizeof(float) * popcount32(channel_mask) * n_samples_);
 
+	uint8_t *dst = data.data();
 	for (uint32_t i_channel = 0; i_channel < n_channels_; i_channel++) {
-		uint8_t *start = static_cast<uint8_t *>(data_[i_channel]);
-		memcpy(data.data() + sizeof(float) * n_samples_ * i_channel, start, sizeof(float) * n_samples_);
+		if (!(channel_mask & (1u << i_channel)))
+			continue;
+		const float *src = static_cast<const float *>(data_[i_channel]);
+		float *t = through && through[i_channel] != data_[i_channel] ? static_cast<float *>(through[i_channel])
+									       : nullptr;
+		if (levels && i_channel < AUDIO_LEVELS_MAX_CHANNELS) {
+			float &peak = levels->peak[i_channel];
+			double &sum_sq = levels->sum_sq[i_channel];
+			if (t)
+				copy_measure<true>(reinterpret_cast<float *>(dst), t, src, n_samples_, peak, sum_sq);
+			else
+				copy_measure<false>(reinterpret_cast<float *>(dst), nullptr, src, n_samples_, peak, sum_sq);
+		} else {
+			memcpy(dst, src, sizeof(float) * n_samples_);
+			if (t)
+				memcpy(t, src, sizeof(float) * n_samples_);
+		}
+		dst += sizeof(float) * n_samples_;
 	}
 }
 
-void audio_buffer::add_float(void **data, uint32_t n_channels, uint32_t n_samples)
+const float *audio_packet::channel(uint32_t i_channel) const noexcept
+{
+	if (i_channel >= n_channels || !(channel_mask & (1u << i_channel)))
+		return nullptr;
+
+	uint32_t index = popcount32(channel_mask & ((1u << i_channel) - 1));
+	return reinterpret_cast<const float *>(data.data()) + index * n_samples;
+}
+
+/* Adds the dropped frames to the packet that follows the dropped ones. */
+void audio_buffer::carry_drop(uint32_t n_frames, bool resync, bool q1_locked)
+{
+	audio_packet *next = nullptr;
+	if (q1_locked && q1.size())
+		next = &q1.front();
+	else if (q2.size())
+		next = &q2.front();
+
+	if (next) {
+		next->n_dropped_before += n_frames;
+		next->resync = next->resync || resync;
+	} else {
+		pending_dropped += n_frames;
+		pending_resync = pending_resync || resync;
+	}
+}
+
+void audio_buffer::drop_front(std::queue<audio_packet> &q, bool q1_locked)
+{
+	uint32_t n_frames = q.front().n_samples + q.front().n_dropped_before;
+	bool resync = q.front().resync;
+	n_dropped_frames.fetch_add(q.front().n_samples, std::memory_order_relaxed);
+	q.pop();
+	carry_drop(n_frames, resync, q1_locked);
+}
+
+/* Returns false if the new packet has to be dropped. */
+bool audio_buffer::handle_overflow(bool q1_locked, audio_buffer_overflow_policy policy_local)
+{
+	size_t n_queued = (q1_locked ? q1.size() : n_q1.load(std::memory_order_relaxed)) + q2.size();
+	if (n_queued < capacity)
+		return true;
+
+	switch (policy_local) {
+	case overflow_drop_oldest:
+		if (q1_locked && q1.size()) {
+			drop_front(q1, q1_locked);
+		} else if (q2.size()) {
+			drop_front(q2, q1_locked);
+		} else {
+			/* The oldest packets are being read by the sender. */
+			n_dropped_newest.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		n_dropped_oldest.fetch_add(1, std::memory_order_relaxed);
+		return true;
+
+	case overflow_resync:
+		if (q1_locked) {
+			while (q1.size())
+				drop_front(q1, q1_locked);
+		}
+		while (q2.size())
+			drop_front(q2, q1_locked);
+		pending_resync = true;
+		n_resyncs.fetch_add(1, std::memory_order_relaxed);
+		return true;
+
+	case overflow_drop_newest:
+	default:
+		n_dropped_newest.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+}
+
+bool audio_buffer::add_float(void **data, uint32_t n_channels, uint32_t channel_mask, uint32_t n_samples,
+			     const audio_timestamp &timestamp, void **through)
 {
 	std::unique_lock q1_lock(q1_mutex, std::try_to_lock);
 
+	bool add = handle_overflow(!!q1_lock, policy.load(std::memory_order_relaxed));
+
 	if (q1_lock) {
 		while (q2.size()) {
 			auto &pkt = q1.emplace();
 			pkt.swap(q2.front());
 			q2.pop();
 		}
+	}
+
+	if (!add) {
+		pending_dropped += n_samples;
+		n_dropped_frames.fetch_add(n_samples, std::memory_order_relaxed);
+		VBAN_TRACE3(handoff, this, 0, n_samples);
+		return false;
+	}
 
-		auto &pkt = q1.emplace();
-		pkt.copy_float(data, n_channels, n_samples);
+	auto &pkt = q1_lock ? q1.emplace() : q2.emplace();
+	pkt.copy_float(data, n_channels, channel_mask, n_samples, &levels, through);
+	pkt.n_dropped_before = pending_dropped;
+	pkt.resync = pending_resync;
+	pkt.speed = speed;
+	pkt.sequence = ++last_sequence;
+	pkt.timestamp = timestamp;
+	pending_dropped = 0;
+	pending_resync = false;
+	VBAN_TRACE3(handoff, this, pkt.sequence, n_samples);
 
+	if (q1_lock) {
+		n_q1.store((uint32_t)q1.size(), std::memory_order_relaxed);
 		cond.notify_one();
-	} else {
-		auto &pkt = q2.emplace();
-		pkt.copy_float(data, n_channels, n_samples);
 	}
+
+	return true;
 }
 
 bool audio_buffer::get(audio_packet &pkt)
 {
 	std::unique_lock q1_lock(q1_mutex);
 
+	return pop(pkt);
+}
+
+bool audio_buffer::pop(audio_packet &pkt)
+{
 	if (!q1.size())
 		return false;
 
 	pkt.swap(q1.front());
 	q1.pop();
+	n_q1.store((uint32_t)q1.size(), std::memory_order_relaxed);
 	return true;
 }
 
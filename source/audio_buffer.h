@@ -2,35 +2,140 @@
 
 #include <cstdint>
 #include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <queue>
 #include <vector>
 
+/* Position of a block on the host's timeline, taken from `ProcessContext`. */
+struct audio_timestamp
+{
+	int64_t system_time; /* nanoseconds, host clock */
+	int64_t cont_time;   /* samples, continuous since the host started processing */
+	bool system_time_valid;
+	bool cont_time_valid;
+};
+
+#define AUDIO_LEVELS_MAX_CHANNELS 32
+
+/* Peak and sum of squares of the host input channels, before the routing matrix. The
+ * captured channels are measured while `add_float` copies them, the others by `measure`.
+ * Used only by the audio thread. */
+struct audio_levels
+{
+	float peak[AUDIO_LEVELS_MAX_CHANNELS];
+	double sum_sq[AUDIO_LEVELS_MAX_CHANNELS];
+	uint32_t n_frames; /* counted by the caller, once per block */
+
+	audio_levels()
+	{
+		reset();
+	}
+	void reset() noexcept;
+
+	/* Measures a channel that is not copied. */
+	void measure(uint32_t i_channel, const float *src, uint32_t n) noexcept;
+};
+
 struct audio_packet
 {
 	std::vector<uint8_t> data;
 	uint32_t n_channels;
+	uint32_t channel_mask; /* channels stored in `data`, others were not captured */
 	uint32_t n_samples;
+	uint32_t n_dropped_before; /* frames dropped just before this packet */
+	bool resync;               /* the sender should discard its backlog */
+	uint32_t speed;            /* relative to real time, see `audio_buffer::speed` */
+	uint64_t sequence;         /* order in which the blocks were queued, from 1 */
+	audio_timestamp timestamp;
+
+	/* Copies the channels in `channel_mask`, adding their levels to `levels` if not null.
+	 * The channels are also copied to `through` if not null, unless it aliases `data`. */
+	void copy_float(void **data, uint32_t n_channels, uint32_t channel_mask, uint32_t n_samples,
+			audio_levels *levels = nullptr, void **through = nullptr) noexcept;
 
-	void copy_float(void **data, uint32_t n_channels, uint32_t n_samples) noexcept;
+	/* Returns the captured samples of the channel, or null if it was not captured. */
+	const float *channel(uint32_t i_channel) const noexcept;
 
 	inline void swap(struct audio_packet &x) noexcept
 	{
 		std::swap(n_channels, x.n_channels);
+		std::swap(channel_mask, x.channel_mask);
 		std::swap(n_samples, x.n_samples);
+		std::swap(n_dropped_before, x.n_dropped_before);
+		std::swap(resync, x.resync);
+		std::swap(speed, x.speed);
+		std::swap(sequence, x.sequence);
+		std::swap(timestamp, x.timestamp);
 		data.swap(x.data);
 	}
 };
 
+enum audio_buffer_overflow_policy {
+	overflow_drop_oldest = 0,
+	overflow_drop_newest,
+	overflow_resync, /* drop everything queued and restart from the live edge */
+	overflow_policy_count,
+};
+
 struct audio_buffer
 {
 	std::queue<audio_packet> q1, q2;
 	std::mutex q1_mutex;
 	std::condition_variable cond;
 
-	void add_float(void **data, uint32_t n_channels, uint32_t n_samples);
+	/* Maximum number of queued packets and what to do when it is reached. The capacity is
+	 * set by the audio thread, the policy also by `setState` on another thread. */
+	uint32_t capacity = UINT32_MAX;
+	std::atomic<audio_buffer_overflow_policy> policy{overflow_drop_oldest};
+
+	/* Speed at which the audio arrives and has to be sent, relative to real time.
+	 * Higher than 1 when the host renders offline in bursts. Set by the audio thread. */
+	uint32_t speed = 1;
+
+	/* Whether the host processes in real time, so that blocks later than the wire are
+	 * concealed rather than waited for. False offline, suspended included, and from
+	 * `setProcessing(false)` until the next block. Set by the audio thread and read by the
+	 * sender thread each time it wakes, since no block comes to tell it in these cases. */
+	std::atomic<bool> realtime{true};
+
+	std::atomic<uint64_t> n_dropped_oldest{0};
+	std::atomic<uint64_t> n_dropped_newest{0};
+	std::atomic<uint64_t> n_resyncs{0};
+	std::atomic<uint64_t> n_dropped_frames{0};
+
+	/* Levels of the queued audio, blocks dropped by the policy are not measured.
+	 * Used only by the audio thread. */
+	audio_levels levels;
+
+	/* Queues the channels in `channel_mask` of `data`, copying them also to `through` in the
+	 * same pass if not null. Returns false if the block was dropped, then nothing is copied. */
+	bool add_float(void **data, uint32_t n_channels, uint32_t channel_mask, uint32_t n_samples,
+		       const audio_timestamp &timestamp, void **through = nullptr);
 	bool get(audio_packet &pkt);
 
+	/* Same as `get` but `q1_mutex` has to be locked by the caller. */
+	bool pop(audio_packet &pkt);
+
 	void notify();
+
+	/* Makes the sender discard its backlog when the next packet is queued. Used only by
+	 * the audio thread. */
+	inline void resync() noexcept
+	{
+		pending_resync = true;
+	}
+
+private:
+	std::atomic<uint32_t> n_q1{0};
+
+	/* Drops carried to the next packet to be queued, used only by `add_float` */
+	uint32_t pending_dropped = 0;
+	bool pending_resync = false;
+	uint64_t last_sequence = 0;
+
+	bool handle_overflow(bool q1_locked, audio_buffer_overflow_policy policy_local);
+	void drop_front(std::queue<audio_packet> &q, bool q1_locked);
+	void carry_drop(uint32_t n_frames, bool resync, bool q1_locked);
 };
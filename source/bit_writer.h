@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+/* Quantizes `v` in [-1, 1) to an integer of the resolution given by `scale`, rounding half away
+ * from zero. Used by every integer format, packed and lossless included. */
+static inline int32_t float_to_int(float v, float scale) noexcept
+{
+	float x = std::min(std::max(v * scale, -scale), scale - 1.0f);
+	return (int32_t)(x + std::copysign(0.5f, x));
+}
+
+/* Appends bits from the least significant one, in little endian 32-bit words. */
+struct bit_writer
+{
+	uint8_t *dst;
+	uint64_t acc = 0;
+	uint32_t n_bits = 0;
+
+	/* `v` has to be masked to `bits`, up to 32 bits. */
+	inline void put(uint64_t v, uint32_t bits) noexcept
+	{
+		acc |= v << n_bits;
+		n_bits += bits;
+		if (n_bits >= 32) {
+			uint32_t w = (uint32_t)acc;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			w = __builtin_bswap32(w);
+#endif
+			memcpy(dst, &w, 4);
+			dst += 4;
+			acc >>= 32;
+			n_bits -= 32;
+		}
+	}
+
+	/* Writes `q` zeros followed by a one. */
+	inline void put_unary(uint32_t q) noexcept
+	{
+		for (; q >= 32; q -= 32)
+			put(0, 32);
+		put(1u << q, q + 1);
+	}
+
+	inline void finish() noexcept
+	{
+		for (; n_bits > 0; n_bits = n_bits > 8 ? n_bits - 8 : 0) {
+			*dst++ = (uint8_t)acc;
+			acc >>= 8;
+		}
+	}
+};
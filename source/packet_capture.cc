@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+#include "packet_capture.h"
+
+#define PCAP_MAGIC 0xA1B2C3D4
+#define PCAP_LINKTYPE_IPV4 228
+#define PCAP_SNAPLEN 65535
+
+#define IO_BUFFER_SIZE (1 << 20)
+#define PREALLOCATE_SIZE (64 << 20)
+
+struct pcap_file_header
+{
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_record_header
+{
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+/* The packets are recorded with synthesized IPv4 and UDP headers so that
+ * common tools can decode the VBAN payload. The addresses and ports are those
+ * of the socket and the destination. Fields are in network byte order. */
+struct ipv4_udp_header
+{
+	uint8_t ver_ihl;
+	uint8_t tos;
+	uint8_t total_length[2];
+	uint8_t id[2];
+	uint8_t frag[2];
+	uint8_t ttl;
+	uint8_t protocol;
+	uint8_t checksum[2];
+	uint8_t saddr[4];
+	uint8_t daddr[4];
+	uint8_t sport[2];
+	uint8_t dport[2];
+	uint8_t udp_length[2];
+	uint8_t udp_checksum[2];
+};
+
+static inline void set_be16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xFF;
+}
+
+packet_capture::~packet_capture()
+{
+	close();
+}
+
+bool packet_capture::open(const char *path, size_t ring_size)
+{
+	if (running)
+		close();
+
+	fp = fopen(path, "wb");
+	if (!fp) {
+		fprintf(stderr, "Error: Failed to open capture file '%s'. errno=%d\n", path, errno);
+		return false;
+	}
+
+	fp_buffer.reset(new char[IO_BUFFER_SIZE]);
+	setvbuf(fp, fp_buffer.get(), _IOFBF, IO_BUFFER_SIZE);
+
+	pcap_file_header hdr = {PCAP_MAGIC, 2, 4, 0, 0, PCAP_SNAPLEN, PCAP_LINKTYPE_IPV4};
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	file_size = sizeof(hdr);
+	file_reserved = 0;
+	reserve(file_size);
+
+	written = 0;
+	dropped = 0;
+	this->ring_size = 0;
+	grow_ring(ring_size);
+
+	start_writer();
+	return true;
+}
+
+void packet_capture::close()
+{
+	if (!running)
+		return;
+
+	stop_writer();
+
+	fclose(fp);
+	fp = nullptr;
+	fp_buffer.reset();
+	ring.reset();
+	ring_size = 0;
+
+	if (n_dropped())
+		fprintf(stderr, "Warning: packet capture dropped %llu of %llu packets\n",
+			(unsigned long long)n_dropped(), (unsigned long long)(n_dropped() + n_written()));
+}
+
+void packet_capture::grow_ring(size_t size)
+{
+	/* At least two packets of the largest size, so that one fits after any wrap. */
+	size = std::max(size, 2 * ring_bytes(VBAN_PROTOCOL_MAX_SIZE));
+	size = (size + 7) & ~(size_t)7;
+	if (size <= ring_size)
+		return;
+
+	const bool was_running = running;
+	if (was_running)
+		stop_writer();
+
+	ring.reset(new uint64_t[size / 8]);
+	ring_size = size;
+	head = 0;
+	tail = 0;
+
+	if (was_running)
+		start_writer();
+}
+
+void packet_capture::start_writer()
+{
+	running = true;
+	pthread_create(&thread, NULL, packet_capture::writer_entry, this);
+}
+
+void packet_capture::stop_writer()
+{
+	{
+		std::unique_lock lk(mutex);
+		running = false;
+		cond.notify_one();
+	}
+	pthread_join(thread, NULL);
+}
+
+void packet_capture::push(const uint8_t *data, uint32_t size, uint32_t saddr, uint16_t sport, uint32_t daddr,
+			  uint16_t dport) noexcept
+{
+	const uint64_t need = ring_bytes(size);
+	const uint64_t h = head.load(std::memory_order_relaxed);
+	const uint64_t pos = ring_size - h % ring_size < need ? skip_wrap(h) : h;
+	if (size > VBAN_PROTOCOL_MAX_SIZE || pos + need - tail.load(std::memory_order_acquire) > ring_size) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	/* The writer skips the end of the ring by itself if a record header does not fit. */
+	if (pos != h && ring_size - h % ring_size >= sizeof(record))
+		record_at(h)->size = wrap_marker;
+
+	auto now = std::chrono::system_clock::now().time_since_epoch();
+
+	record &r = *record_at(pos);
+	r.time_us = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+	r.saddr = saddr;
+	r.daddr = daddr;
+	r.sport = sport;
+	r.dport = dport;
+	r.size = size;
+	memcpy(&r + 1, data, size);
+
+	head.store(pos + need, std::memory_order_release);
+}
+
+void packet_capture::reserve(uint64_t size)
+{
+#ifdef __linux__
+	/* Reserve blocks ahead of the write position without changing the file
+	 * size so that appending does not have to wait for block allocation. */
+	if (size <= file_reserved)
+		return;
+	if (fallocate(fileno(fp), FALLOC_FL_KEEP_SIZE, (off_t)file_reserved, PREALLOCATE_SIZE) == 0)
+		file_reserved += PREALLOCATE_SIZE;
+	else
+		file_reserved = UINT64_MAX; /* not supported by the file system */
+#else
+	(void)size;
+#endif
+}
+
+void packet_capture::write_record(const record &r)
+{
+	const uint32_t len = sizeof(ipv4_udp_header) + r.size;
+
+	pcap_record_header rh;
+	rh.ts_sec = (uint32_t)(r.time_us / 1000000);
+	rh.ts_usec = (uint32_t)(r.time_us % 1000000);
+	rh.incl_len = len;
+	rh.orig_len = len;
+
+	ipv4_udp_header ih = {};
+	ih.ver_ihl = 0x45;
+	set_be16(ih.total_length, (uint16_t)len);
+	ih.ttl = 64;
+	ih.protocol = 17; /* UDP */
+	memcpy(ih.saddr, &r.saddr, 4);
+	memcpy(ih.daddr, &r.daddr, 4);
+	memcpy(ih.sport, &r.sport, 2);
+	memcpy(ih.dport, &r.dport, 2);
+	set_be16(ih.udp_length, (uint16_t)(8 + r.size));
+
+	uint32_t sum = 0;
+	const uint8_t *p = reinterpret_cast<const uint8_t *>(&ih);
+	for (int i = 0; i < 20; i += 2)
+		sum += (p[i] << 8) | p[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	set_be16(ih.checksum, (uint16_t)~sum);
+
+	fwrite(&rh, sizeof(rh), 1, fp);
+	fwrite(&ih, sizeof(ih), 1, fp);
+	fwrite(&r + 1, r.size, 1, fp);
+
+	file_size += sizeof(rh) + len;
+	reserve(file_size + IO_BUFFER_SIZE);
+}
+
+void packet_capture::writer_loop()
+{
+	while (true) {
+		uint64_t t = tail.load(std::memory_order_relaxed);
+		uint64_t h = head.load(std::memory_order_acquire);
+
+		while (t < h) {
+			if (ring_size - t % ring_size < sizeof(record) || record_at(t)->size == wrap_marker) {
+				t = skip_wrap(t);
+				continue;
+			}
+			const record &r = *record_at(t);
+			write_record(r);
+			t += ring_bytes(r.size);
+			tail.store(t, std::memory_order_release);
+			written.fetch_add(1, std::memory_order_relaxed);
+		}
+		tail.store(t, std::memory_order_release);
+
+		std::unique_lock lk(mutex);
+		if (!running && head.load(std::memory_order_acquire) == t)
+			break;
+
+		/* The sender does not notify; the ring is sized for several times this period. */
+		cond.wait_for(lk, std::chrono::milliseconds(20));
+	}
+
+	fflush(fp);
+}
+
+void *packet_capture::writer_entry(void *data)
+{
+	static_cast<packet_capture *>(data)->writer_loop();
+	return NULL;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <condition_variable>
+#include <mutex>
+#include <memory>
+#include <pthread.h>
+#include "vban.h"
+
+/* Writes a copy of every packet sent on the wire into a pcap file.
+ * `push` is called from the sender thread and never blocks; records are
+ * handed to a writer thread through a ring of bytes, each taking the size of
+ * its packet, and counted as dropped when the ring is full.
+ * The IPv4 and UDP headers are synthesized from the addresses given to `push`;
+ * the TTL, the IP identification and the UDP checksum are not those on the wire. */
+struct packet_capture
+{
+	packet_capture() = default;
+	~packet_capture();
+
+	/* The ring holds `ring_size` bytes, see `ring_bytes` for the size of a record. */
+	bool open(const char *path, size_t ring_size);
+	void close();
+	/* Reallocates the ring if it is smaller than `ring_size`, the records in it are written
+	 * first. Must not be called while `push` runs. */
+	void grow_ring(size_t ring_size);
+	inline bool is_open() const noexcept
+	{
+		return running;
+	}
+
+	/* Addresses and ports are in network byte order. */
+	void push(const uint8_t *data, uint32_t size, uint32_t saddr, uint16_t sport, uint32_t daddr,
+		  uint16_t dport) noexcept;
+
+	/* Bytes of the ring a packet of `size` bytes takes. */
+	static inline size_t ring_bytes(uint32_t size) noexcept
+	{
+		return sizeof(record) + ((size + 7) & ~7u);
+	}
+
+	inline uint64_t n_written() const noexcept
+	{
+		return written.load(std::memory_order_relaxed);
+	}
+	inline uint64_t n_dropped() const noexcept
+	{
+		return dropped.load(std::memory_order_relaxed);
+	}
+
+private:
+	/* Followed by the packet, padded to 8 bytes. A record that does not fit before the end of
+	 * the ring starts over at its beginning, the bytes left are skipped. */
+	struct record
+	{
+		int64_t time_us;
+		uint32_t saddr;
+		uint32_t daddr;
+		uint16_t sport;
+		uint16_t dport;
+		uint32_t size; /* `wrap_marker` if the rest of the ring is skipped */
+	};
+
+	static const uint32_t wrap_marker = UINT32_MAX;
+
+	std::unique_ptr<uint64_t[]> ring; /* of `ring_size` bytes, aligned for `record` */
+	size_t ring_size = 0;
+	std::atomic<uint64_t> head{0}; /* bytes filled by `push` */
+	std::atomic<uint64_t> tail{0}; /* bytes consumed by the writer */
+	std::atomic<uint64_t> written{0};
+	std::atomic<uint64_t> dropped{0};
+
+	FILE *fp = nullptr;
+	std::unique_ptr<char[]> fp_buffer;
+	uint64_t file_size = 0;
+	uint64_t file_reserved = 0;
+
+	pthread_t thread;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::atomic<bool> running{false}; /* read by the sender thread in `is_open` */
+
+	inline record *record_at(uint64_t pos) const noexcept
+	{
+		return reinterpret_cast<record *>(reinterpret_cast<uint8_t *>(ring.get()) + pos % ring_size);
+	}
+	inline uint64_t skip_wrap(uint64_t pos) const noexcept
+	{
+		return pos + ring_size - pos % ring_size;
+	}
+
+	void write_record(const record &r);
+	void reserve(uint64_t size);
+	void start_writer();
+	void stop_writer();
+	void writer_loop();
+	static void *writer_entry(void *data);
+};
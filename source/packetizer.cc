@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PACKETIZER_USE_SSE2
+#endif
+#include "vban.h"
+#include "packetizer.h"
+#include "bit_writer.h"
+
+struct fmt_float32
+{
+	static constexpr uint8_t format_bit = VBAN_BITFMT_32_FLOAT;
+	static constexpr uint32_t bytes = 4;
+
+	static inline void write(uint8_t *p, float v) noexcept
+	{
+		memcpy(p, &v, 4);
+	}
+};
+
+struct fmt_int16
+{
+	static constexpr uint8_t format_bit = VBAN_BITFMT_16_INT;
+	static constexpr uint32_t bytes = 2;
+
+	static inline void write(uint8_t *p, float v) noexcept
+	{
+		int16_t x = (int16_t)float_to_int(v, 32768.0f);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		x = (int16_t)((x << 8) | ((x >> 8) & 0xFF));
+#endif
+		memcpy(p, &x, 2);
+	}
+};
+
+struct fmt_int24
+{
+	static constexpr uint8_t format_bit = VBAN_BITFMT_24_INT;
+	static constexpr uint32_t bytes = 3;
+
+	static inline void write(uint8_t *p, float v) noexcept
+	{
+		int32_t x = float_to_int(v, 8388608.0f);
+		p[0] = x & 0xFF;
+		p[1] = (x >> 8) & 0xFF;
+		p[2] = (x >> 16) & 0xFF;
+	}
+};
+
+/* Quantizes the interleaved samples to `BITS` and packs them. The layout does not
+ * depend on the channel count, so one instance serves every layout. */
+template<uint32_t BITS>
+static uint32_t encode_packed(const float *src, uint32_t n_channels, uint32_t n_frames, uint8_t, uint8_t *dst)
+{
+	constexpr float scale = (float)(1u << (BITS - 1));
+	constexpr uint32_t mask = (1u << BITS) - 1;
+	const uint32_t n = n_channels * n_frames;
+
+	bit_writer w{dst};
+	uint32_t i = 0;
+#ifdef PACKETIZER_USE_SSE2
+	/* Four samples are quantized at once and paired in 64-bit lanes, so the writer
+	 * takes `2 * BITS` bits at a time. */
+	const __m128 v_scale = _mm_set1_ps(scale);
+	const __m128 v_min = _mm_set1_ps(-scale);
+	const __m128 v_max = _mm_set1_ps(scale - 1.0f);
+	const __m128 v_sign = _mm_set1_ps(-0.0f);
+	const __m128 v_half = _mm_set1_ps(0.5f);
+	const __m128i v_mask = _mm_set1_epi32((int)mask);
+	const __m128i v_low = _mm_set_epi32(0, -1, 0, -1);
+	for (; i + 4 <= n; i += 4) {
+		__m128 x = _mm_mul_ps(_mm_loadu_ps(src + i), v_scale);
+		x = _mm_min_ps(_mm_max_ps(x, v_min), v_max);
+		/* Rounds half away from zero, as `float_to_int` does. */
+		x = _mm_add_ps(x, _mm_or_ps(_mm_and_ps(x, v_sign), v_half));
+		__m128i q = _mm_and_si128(_mm_cvttps_epi32(x), v_mask);
+		__m128i pairs = _mm_or_si128(_mm_and_si128(q, v_low), _mm_slli_epi64(_mm_srli_epi64(q, 32), BITS));
+		alignas(16) uint64_t p[2];
+		_mm_store_si128(reinterpret_cast<__m128i *>(p), pairs);
+		w.put(p[0], 2 * BITS);
+		w.put(p[1], 2 * BITS);
+	}
+#endif
+	for (; i < n; i++)
+		w.put((uint32_t)float_to_int(src[i], scale) & mask, BITS);
+	w.finish();
+	return (n * BITS + 7) / 8;
+}
+
+template<uint32_t BITS>
+static uint32_t encode_lossless(const float *src, uint32_t n_channels, uint32_t n_frames, uint8_t, uint8_t *dst)
+{
+	return vban_lossless_encode(src, n_channels, n_frames, BITS, dst);
+}
+
+template<uint32_t N_CH>
+static void interleave_fixed(const float *const *planes, uint32_t, uint32_t n_frames, float *__restrict dst)
+{
+	for (uint32_t ch = 0; ch < N_CH; ch++) {
+		const float *__restrict p = planes[ch];
+		for (uint32_t i = 0; i < n_frames; i++)
+			dst[i * N_CH + ch] = p[i];
+	}
+}
+
+static void interleave_generic(const float *const *planes, uint32_t n_channels, uint32_t n_frames, float *dst)
+{
+	for (uint32_t i = 0; i < n_frames; i++) {
+		for (uint32_t ch = 0; ch < n_channels; ch++)
+			dst[i * n_channels + ch] = planes[ch][i];
+	}
+}
+
+template<uint32_t N_CH, typename Fmt>
+static uint32_t encode_fixed(const float *src, uint32_t, uint32_t n_frames, uint8_t, uint8_t *dst)
+{
+	constexpr uint32_t frame_bytes = N_CH * Fmt::bytes;
+
+	if constexpr (Fmt::format_bit == VBAN_BITFMT_32_FLOAT) {
+		memcpy(dst, src, n_frames * frame_bytes);
+	} else {
+		for (uint32_t i = 0; i < n_frames; i++) {
+			for (uint32_t ch = 0; ch < N_CH; ch++)
+				Fmt::write(dst + ch * Fmt::bytes, src[ch]);
+			src += N_CH;
+			dst += frame_bytes;
+		}
+	}
+	return n_frames * frame_bytes;
+}
+
+static uint32_t encode_generic(const float *src, uint32_t n_channels, uint32_t n_frames, uint8_t format_bit,
+			       uint8_t *dst)
+{
+	const uint32_t n_samples = n_channels * n_frames;
+	uint8_t *const start = dst;
+
+	switch (format_bit) {
+	case VBAN_BITFMT_12_INT:
+		return encode_packed<12>(src, n_channels, n_frames, format_bit, dst);
+	case VBAN_BITFMT_10_INT:
+		return encode_packed<10>(src, n_channels, n_frames, format_bit, dst);
+	case VBAN_CODEC_USER | VBAN_BITFMT_16_INT:
+		return encode_lossless<16>(src, n_channels, n_frames, format_bit, dst);
+	case VBAN_CODEC_USER | VBAN_BITFMT_24_INT:
+		return encode_lossless<24>(src, n_channels, n_frames, format_bit, dst);
+	}
+
+	for (uint32_t i = 0; i < n_samples; i++) {
+		switch (format_bit) {
+		case VBAN_BITFMT_32_FLOAT:
+			fmt_float32::write(dst, src[i]);
+			dst += fmt_float32::bytes;
+			break;
+		case VBAN_BITFMT_16_INT:
+			fmt_int16::write(dst, src[i]);
+			dst += fmt_int16::bytes;
+			break;
+		case VBAN_BITFMT_24_INT:
+			fmt_int24::write(dst, src[i]);
+			dst += fmt_int24::bytes;
+			break;
+		}
+	}
+	return (uint32_t)(dst - start);
+}
+
+/* Returns true if the encoder is specialized for the layout. The packed formats have one
+ * encoder for every layout and take the fixed interleave only. The lossless encoder takes
+ * most of the time, the fixed interleave does not make a measurable difference to it. */
+template<uint32_t N_CH>
+static bool select_fixed(packetizer &p, uint8_t format_bit)
+{
+	if ((format_bit & VBAN_CODEC_MASK) == VBAN_CODEC_USER)
+		return false;
+
+	p.interleave = interleave_fixed<N_CH>;
+
+	switch (format_bit) {
+	case VBAN_BITFMT_32_FLOAT:
+		p.encode = encode_fixed<N_CH, fmt_float32>;
+		return true;
+	case VBAN_BITFMT_16_INT:
+		p.encode = encode_fixed<N_CH, fmt_int16>;
+		return true;
+	case VBAN_BITFMT_24_INT:
+		p.encode = encode_fixed<N_CH, fmt_int24>;
+		return true;
+	}
+	return false;
+}
+
+bool packetizer::select_generic(uint8_t format_bit)
+{
+	header_bits = 0;
+	channel_bits = 0;
+
+	switch (format_bit) {
+	case VBAN_BITFMT_32_FLOAT:
+	case VBAN_BITFMT_16_INT:
+	case VBAN_BITFMT_24_INT:
+		sample_bits = 8 * VBanBitResolutionSize[format_bit];
+		break;
+	case VBAN_BITFMT_12_INT:
+		sample_bits = 12;
+		break;
+	case VBAN_BITFMT_10_INT:
+		sample_bits = 10;
+		break;
+	case VBAN_CODEC_USER | VBAN_BITFMT_16_INT:
+	case VBAN_CODEC_USER | VBAN_BITFMT_24_INT:
+		sample_bits = 8 * VBanBitResolutionSize[format_bit & VBAN_BIT_RESOLUTION_MASK];
+		header_bits = VBAN_LOSSLESS_HEADER_BITS;
+		channel_bits = VBAN_LOSSLESS_CHANNEL_BITS;
+		break;
+	default:
+		return false;
+	}
+
+	interleave = interleave_generic;
+	encode = encode_generic;
+	specialized = false;
+	return true;
+}
+
+bool packetizer::select(uint32_t n_channels, uint8_t format_bit)
+{
+	if (!select_generic(format_bit))
+		return false;
+
+	switch (n_channels) {
+	case 1:
+		specialized = select_fixed<1>(*this, format_bit);
+		break;
+	case 2:
+		specialized = select_fixed<2>(*this, format_bit);
+		break;
+	case 4:
+		specialized = select_fixed<4>(*this, format_bit);
+		break;
+	case 8:
+		specialized = select_fixed<8>(*this, format_bit);
+		break;
+	case 16: /* only an aggregation leader sends more than VBAN_ROUTE_MAX_OUT channels */
+		specialized = select_fixed<16>(*this, format_bit);
+		break;
+	}
+
+	return true;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include "vban.h"
+#include "vban_lossless.h"
+
+/* Sample formats selectable by `paramid_format`, in the order of the index kept in the state.
+ * New formats are appended. */
+static const uint8_t packetizer_formats[] = {
+	VBAN_BITFMT_32_FLOAT,
+	VBAN_BITFMT_16_INT,
+	VBAN_BITFMT_24_INT,
+	VBAN_BITFMT_12_INT,
+	VBAN_BITFMT_10_INT,
+	VBAN_CODEC_USER | VBAN_BITFMT_16_INT,
+	VBAN_CODEC_USER | VBAN_BITFMT_24_INT,
+};
+#define PACKETIZER_N_FORMATS (sizeof(packetizer_formats) / sizeof(*packetizer_formats))
+
+/* Format for each step of `paramid_format`. The parameter had float, 16-bit and 24-bit at
+ * the normalized values 0, 0.5 and 1 before the packed and lossless formats came; they stay
+ * there so that automation written then still selects them. */
+static const uint8_t packetizer_format_steps[] = {
+	VBAN_BITFMT_32_FLOAT,
+	VBAN_BITFMT_12_INT,
+	VBAN_BITFMT_10_INT,
+	VBAN_BITFMT_16_INT,
+	VBAN_CODEC_USER | VBAN_BITFMT_16_INT,
+	VBAN_CODEC_USER | VBAN_BITFMT_24_INT,
+	VBAN_BITFMT_24_INT,
+};
+static_assert(sizeof(packetizer_format_steps) == PACKETIZER_N_FORMATS, "one step per format");
+
+static inline uint32_t packetizer_format_step(uint8_t format)
+{
+	for (uint32_t i = 0; i < PACKETIZER_N_FORMATS; i++) {
+		if (packetizer_format_steps[i] == format)
+			return i;
+	}
+	return 0;
+}
+
+/* Converts captured audio into the VBAN payload in two steps.
+ * `interleave` writes `n_frames` frames of planar float channels into an
+ * interleaved float buffer as the audio arrives. `encode` converts
+ * interleaved float frames into the wire sample format when a packet is sent.
+ *
+ * Common channel counts with float32, int16 and int24 have instances with the
+ * channel count and the frame size known at compile time. The packed formats
+ * at these counts only interleave that way, their encoder serves every layout.
+ * Other layouts, and the lossless formats, use a generic instance that looks
+ * them up at run time.
+ *
+ * The 12-bit and 10-bit formats are bit-packed: the interleaved samples are
+ * written as two's complement values one after another from the least
+ * significant bit of the payload, 2 samples in 3 bytes and 4 samples in
+ * 5 bytes. The last byte is padded with zero bits.
+ *
+ * The formats with `VBAN_CODEC_USER` compress the 16-bit or 24-bit samples
+ * losslessly, see `vban_lossless.h`. Their payload size depends on the audio,
+ * `payload_bytes` is its upper bound and `encode` returns the actual size. */
+struct packetizer
+{
+	typedef void (*interleave_fn)(const float *const *planes, uint32_t n_channels, uint32_t n_frames,
+				      float *dst);
+	typedef uint32_t (*encode_fn)(const float *src, uint32_t n_channels, uint32_t n_frames, uint8_t format_bit,
+				      uint8_t *dst);
+
+	interleave_fn interleave = nullptr;
+	encode_fn encode = nullptr;
+	uint32_t sample_bits = 0;
+	/* Bits of the payload in addition to the samples, per packet and per channel */
+	uint32_t header_bits = 0;
+	uint32_t channel_bits = 0;
+	bool specialized = false; /* `encode` is specialized for the layout */
+
+	/* Bytes of the payload of `n_frames` frames, at most. */
+	inline uint32_t payload_bytes(uint32_t n_channels, uint32_t n_frames) const noexcept
+	{
+		return (header_bits + n_channels * (channel_bits + n_frames * sample_bits) + 7) / 8;
+	}
+
+	/* Frames that always fit in `max_bytes` of payload. */
+	inline uint32_t max_frames(uint32_t n_channels, uint32_t max_bytes) const noexcept
+	{
+		uint32_t overhead = header_bits + n_channels * channel_bits;
+		return max_bytes * 8 > overhead ? (max_bytes * 8 - overhead) / (n_channels * sample_bits) : 0;
+	}
+
+	/* Selects the instance for the layout. Returns false if the format is not supported. */
+	bool select(uint32_t n_channels, uint8_t format_bit);
+
+	/* Selects the generic instance, regardless of the layout. */
+	bool select_generic(uint8_t format_bit);
+};
@@ -1,9 +1,62 @@
 #pragma once
 
+/* Ranges of the latency parameters in milliseconds. */
+#define VBAN_LATENCY_TARGET_MAX_MS 500
+#define VBAN_LATENCY_MAX_MS 1000
+
+/* Lowest level shown by the meters in dBFS, the range is up to 0 dBFS. */
+#define VBAN_LEVEL_FLOOR_DB -60
+
+/* Range of the send buffer parameter in KiB. */
+#define VBAN_SNDBUF_MAX_KB 4096
+
+/* What `process()` writes to the output bus. */
+enum vban_output_mode {
+	output_pass_through = 0,
+	output_mute,
+	/* The output buffers are left as given by the host. Those not shared with the input hold
+	 * whatever the host left there, so they are flagged silent and the host must not use them. */
+	output_bypass,
+	output_mode_count,
+};
+
+/* What the sender does while the host renders offline, faster than real time. */
+enum vban_offline_mode {
+	offline_throttle = 0, /* `process()` waits so that the stream goes at real time */
+	offline_burst,        /* same at a few times real time, for receivers that record */
+	offline_suspend,      /* nothing is sent until the host is back to real time */
+	offline_mode_count,
+};
+
 enum {
 	paramid_ipv4_0 = 0,
 	paramid_ipv4_1,
 	paramid_ipv4_2,
 	paramid_ipv4_3,
 	paramid_port,
+	paramid_fec_group,
+	paramid_vban_channels,
+	paramid_format,
+	paramid_overflow_policy,
+	paramid_latency_target, /* 0 selects the minimum safe latency */
+	paramid_latency,        /* read-only, reported by the processor */
+	paramid_txtime,
+	paramid_dscp,
+	paramid_so_priority,
+	paramid_sndbuf,
+	paramid_transport,
+	paramid_group,        /* aggregation group, 0 for none */
+	paramid_group_offset, /* first channel of this instance in the group stream */
+	paramid_output_mode,
+	paramid_offline_mode,
+	paramid_capture, /* pcap of the sent packets, see `VBAN_CAPTURE_FILE` */
+
+	/* Gain from the host input channel `i` to the VBAN channel `o` is
+	 * `paramid_route_gain + o * VBAN_ROUTE_MAX_IN + i`. */
+	paramid_route_gain = 0x100,
+
+	/* Read-only levels of the host input channel `i` before the routing matrix, reported
+	 * by the processor, are `paramid_level_peak + i` and `paramid_level_rms + i`. */
+	paramid_level_peak = 0x200,
+	paramid_level_rms = 0x280,
 };
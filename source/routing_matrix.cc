@@ -0,0 +1,192 @@
+#include <cstring>
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define ROUTING_USE_SSE
+#endif
+
+#include "routing_matrix.h"
+
+routing_matrix::routing_matrix()
+{
+	for (uint32_t o = 0; o < VBAN_ROUTE_MAX_OUT; o++) {
+		for (uint32_t i = 0; i < VBAN_ROUTE_MAX_IN; i++)
+			gain[o][i] = o == i ? 1.0f : 0.0f;
+	}
+}
+
+uint32_t routing_matrix::input_mask(uint32_t n_in) const noexcept
+{
+	uint32_t mask = 0;
+	for (uint32_t o = 0; o < n_out; o++) {
+		for (uint32_t i = 0; i < n_in; i++) {
+			if (gain[o][i] != 0.0f)
+				mask |= 1u << i;
+		}
+	}
+	return mask;
+}
+
+bool routing_matrix::is_identity(uint32_t n_in) const noexcept
+{
+	if (n_out > n_in)
+		return false;
+
+	for (uint32_t o = 0; o < n_out; o++) {
+		for (uint32_t i = 0; i < n_in; i++) {
+			if (gain[o][i] != (o == i ? 1.0f : 0.0f))
+				return false;
+		}
+	}
+	return true;
+}
+
+/* dst[k] += src[k] * (g + dg * k) */
+static void mix_ramp(float *dst, const float *src, float g, float dg, uint32_t n) noexcept
+{
+	uint32_t k = 0;
+#ifdef ROUTING_USE_SSE
+	__m128 gv = _mm_setr_ps(g, g + dg, g + 2 * dg, g + 3 * dg);
+	const __m128 step = _mm_set1_ps(4 * dg);
+	for (; k + 4 <= n; k += 4) {
+		__m128 d = _mm_loadu_ps(dst + k);
+		d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(src + k), gv));
+		_mm_storeu_ps(dst + k, d);
+		gv = _mm_add_ps(gv, step);
+	}
+#endif
+	for (; k < n; k++)
+		dst[k] += src[k] * (g + dg * k);
+}
+
+/* Returns false if the inputs can be used as the outputs without mixing. */
+bool routing_mixer::prepare(const routing_matrix &target, const float *const *in, uint32_t n_in) noexcept
+{
+	if (!initialized) {
+		memcpy(current, target.gain, sizeof(current));
+		initialized = true;
+	}
+
+	const bool settled = !memcmp(current, target.gain, sizeof(current));
+
+	if (settled && target.is_identity(n_in)) {
+		bool all_captured = true;
+		for (uint32_t o = 0; o < target.n_out; o++)
+			all_captured = all_captured && in[o];
+		if (all_captured)
+			return false;
+	}
+	return true;
+}
+
+bool routing_mixer::process(const routing_matrix &target, const float *const *in, uint32_t n_in, float *const *out,
+			    uint32_t n_samples) noexcept
+{
+	if (!prepare(target, in, n_in))
+		return false;
+
+	const float inv_n = n_samples ? 1.0f / n_samples : 0.0f;
+
+	for (uint32_t o = 0; o < target.n_out; o++) {
+		memset(out[o], 0, sizeof(float) * n_samples);
+
+		for (uint32_t i = 0; i < n_in && i < VBAN_ROUTE_MAX_IN; i++) {
+			const float g0 = current[o][i];
+			const float g1 = target.gain[o][i];
+			if (!in[i] || (g0 == 0.0f && g1 == 0.0f))
+				continue;
+			mix_ramp(out[o], in[i], g0, (g1 - g0) * inv_n, n_samples);
+		}
+	}
+
+	memcpy(current, target.gain, sizeof(current));
+	return true;
+}
+
+bool routing_mixer::process_interleaved(const routing_matrix &target, const float *const *in, uint32_t n_in,
+					float *dst, uint32_t n_samples) noexcept
+{
+	if (!prepare(target, in, n_in))
+		return false;
+
+	const uint32_t n_out = target.n_out;
+	const float inv_n = n_samples ? 1.0f / n_samples : 0.0f;
+
+	/* Inputs contributing to each output, the gain at frame k is `g + dg * k`. */
+	struct term
+	{
+		const float *src;
+		float g, dg;
+	} terms[VBAN_ROUTE_MAX_OUT][VBAN_ROUTE_MAX_IN];
+	uint32_t n_terms[VBAN_ROUTE_MAX_OUT];
+
+	for (uint32_t o = 0; o < n_out; o++) {
+		n_terms[o] = 0;
+		for (uint32_t i = 0; i < n_in && i < VBAN_ROUTE_MAX_IN; i++) {
+			const float g0 = current[o][i];
+			const float g1 = target.gain[o][i];
+			if (!in[i] || (g0 == 0.0f && g1 == 0.0f))
+				continue;
+			terms[o][n_terms[o]++] = {in[i], g0, (g1 - g0) * inv_n};
+		}
+	}
+
+	uint32_t k = 0;
+#ifdef ROUTING_USE_SSE
+	/* Four frames at a time, the ramps step as in `mix_ramp`. The outputs are transposed
+	 * into frames in registers when their count allows it. */
+	__m128 gv[VBAN_ROUTE_MAX_OUT][VBAN_ROUTE_MAX_IN], step[VBAN_ROUTE_MAX_OUT][VBAN_ROUTE_MAX_IN];
+	for (uint32_t o = 0; o < n_out; o++) {
+		for (uint32_t t = 0; t < n_terms[o]; t++) {
+			const term &x = terms[o][t];
+			gv[o][t] = _mm_setr_ps(x.g, x.g + x.dg, x.g + 2 * x.dg, x.g + 3 * x.dg);
+			step[o][t] = _mm_set1_ps(4 * x.dg);
+		}
+	}
+	const bool transpose = n_out <= 2 || n_out % 4 == 0;
+	for (; k + 4 <= n_samples; k += 4) {
+		__m128 acc[VBAN_ROUTE_MAX_OUT];
+		for (uint32_t o = 0; o < n_out; o++) {
+			acc[o] = _mm_setzero_ps();
+			for (uint32_t t = 0; t < n_terms[o]; t++) {
+				acc[o] = _mm_add_ps(acc[o], _mm_mul_ps(_mm_loadu_ps(terms[o][t].src + k), gv[o][t]));
+				gv[o][t] = _mm_add_ps(gv[o][t], step[o][t]);
+			}
+		}
+
+		float *d = dst + k * n_out;
+		if (n_out == 1) {
+			_mm_storeu_ps(d, acc[0]);
+		} else if (n_out == 2) {
+			_mm_storeu_ps(d, _mm_unpacklo_ps(acc[0], acc[1]));
+			_mm_storeu_ps(d + 4, _mm_unpackhi_ps(acc[0], acc[1]));
+		} else if (transpose) {
+			for (uint32_t o = 0; o < n_out; o += 4) {
+				__m128 r0 = acc[o], r1 = acc[o + 1], r2 = acc[o + 2], r3 = acc[o + 3];
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+				_mm_storeu_ps(d + o, r0);
+				_mm_storeu_ps(d + n_out + o, r1);
+				_mm_storeu_ps(d + 2 * n_out + o, r2);
+				_mm_storeu_ps(d + 3 * n_out + o, r3);
+			}
+		} else {
+			for (uint32_t o = 0; o < n_out; o++) {
+				alignas(16) float v[4];
+				_mm_store_ps(v, acc[o]);
+				for (uint32_t j = 0; j < 4; j++)
+					d[j * n_out + o] = v[j];
+			}
+		}
+	}
+#endif
+	for (; k < n_samples; k++) {
+		for (uint32_t o = 0; o < n_out; o++) {
+			float acc = 0.0f;
+			for (uint32_t t = 0; t < n_terms[o]; t++)
+				acc += terms[o][t].src[k] * (terms[o][t].g + terms[o][t].dg * k);
+			dst[k * n_out + o] = acc;
+		}
+	}
+
+	memcpy(current, target.gain, sizeof(current));
+	return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+#define VBAN_ROUTE_MAX_IN 8
+#define VBAN_ROUTE_MAX_OUT 8
+
+/* Gains from the host input channels to the VBAN channels. */
+struct routing_matrix
+{
+	uint32_t n_out = 2;
+	float gain[VBAN_ROUTE_MAX_OUT][VBAN_ROUTE_MAX_IN];
+
+	routing_matrix();
+
+	/* Returns the bit mask of the input channels that contribute to any output. */
+	uint32_t input_mask(uint32_t n_in) const noexcept;
+	bool is_identity(uint32_t n_in) const noexcept;
+};
+
+/* Applies a routing matrix on the sender thread. Gain changes are ramped
+ * linearly over one block so that they do not click. */
+struct routing_mixer
+{
+	/* Mixes `n_in` planar input channels into `target.n_out` planar output
+	 * channels. An input pointer may be null if the channel was not captured.
+	 * Returns false if the inputs can be used as the outputs without mixing;
+	 * `out` is left untouched in that case. */
+	bool process(const routing_matrix &target, const float *const *in, uint32_t n_in, float *const *out,
+		     uint32_t n_samples) noexcept;
+
+	/* Same as `process` but writes the outputs interleaved into `dst`, `target.n_out`
+	 * floats per frame, in the same pass as the mix. */
+	bool process_interleaved(const routing_matrix &target, const float *const *in, uint32_t n_in, float *dst,
+				 uint32_t n_samples) noexcept;
+
+	void reset() noexcept
+	{
+		initialized = false;
+	}
+
+private:
+	bool prepare(const routing_matrix &target, const float *const *in, uint32_t n_in) noexcept;
+
+	float current[VBAN_ROUTE_MAX_OUT][VBAN_ROUTE_MAX_IN];
+	bool initialized = false;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/* Counters of events on the sender thread, and on the audio thread where noted. */
+struct sender_stats
+{
+	std::atomic<uint64_t> n_packets{0};
+	std::atomic<uint64_t> n_backlog_resyncs{0}; /* the backlog was cut back to the target */
+	std::atomic<uint64_t> n_skipped_frames{0};  /* frames never sent, including drops in the queue */
+	std::atomic<uint64_t> n_discontinuities{0}; /* breaks in the host timeline */
+	std::atomic<uint64_t> n_txtime_dropped{0};  /* packets the qdisc dropped for missing their launch time */
+
+	/* Underruns, when the host did not deliver the audio of a packet in time */
+	std::atomic<uint64_t> n_underruns{0};        /* runs of packets padded with concealment */
+	std::atomic<uint64_t> n_concealed_frames{0}; /* frames of concealment sent */
+	std::atomic<uint64_t> n_late_frames{0};      /* frames discarded for arriving after their concealment */
+	std::atomic<uint64_t> n_underrun_pauses{0};  /* underruns too long to conceal, the stream paused */
+
+	/* Aggregation */
+	std::atomic<uint64_t> n_group_dropped_frames{0}; /* frames written too late or too early for the group */
+	std::atomic<uint64_t> n_group_partial_chunks{0}; /* chunks read by the leader with silent members */
+	std::atomic<uint64_t> n_group_resyncs{0};        /* the leader has jumped on its timeline */
+
+	/* Bytes of samples read or written by `process()` on the audio thread */
+	std::atomic<uint64_t> n_process_bytes{0};
+
+	/* Frames buffered ahead of the wire when a packet is sent, averaged. This is
+	 * the latency added by the sender including the packetization delay. */
+	std::atomic<uint32_t> latency_frames{0};
+};
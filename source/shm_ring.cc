@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "shm_ring.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static inline uint32_t align_up(uint32_t x, uint32_t a)
+{
+	return (x + a - 1) / a * a;
+}
+
+shm_ring_writer::~shm_ring_writer()
+{
+	close();
+}
+
+bool shm_ring_writer::create(uint32_t n_slots, uint32_t packet_size_max)
+{
+#ifdef __linux__
+	close();
+
+	if (!n_slots || (n_slots & (n_slots - 1))) {
+		fprintf(stderr, "Error: shm ring needs a power of 2 slots, got %u\n", n_slots);
+		return false;
+	}
+
+	uint32_t slot_offset = align_up(sizeof(vban_shm_header), VBAN_SHM_ALIGN);
+	uint32_t slot_size = align_up(sizeof(vban_shm_slot) + packet_size_max, VBAN_SHM_ALIGN);
+	size_t size = slot_offset + (size_t)slot_size * n_slots;
+
+	memfd = memfd_create("vban-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd < 0) {
+		fprintf(stderr, "Error: Failed to create memfd. errno=%d\n", errno);
+		return false;
+	}
+
+	/* Readers can trust the size once it is sealed. */
+	if (ftruncate(memfd, (off_t)size) != 0 || fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0) {
+		fprintf(stderr, "Error: Failed to size memfd. errno=%d\n", errno);
+		close();
+		return false;
+	}
+
+	void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "Error: Failed to map memfd. errno=%d\n", errno);
+		close();
+		return false;
+	}
+
+	map_size = size;
+	header = static_cast<vban_shm_header *>(p);
+	header->magic = VBAN_SHM_MAGIC;
+	header->version = VBAN_SHM_VERSION;
+	header->n_slots = n_slots;
+	header->slot_size = slot_size;
+	header->slot_offset = slot_offset;
+	header->write_index.store(0, std::memory_order_release);
+	index = 0;
+
+	return true;
+#else
+	(void)n_slots;
+	(void)packet_size_max;
+	fprintf(stderr, "Error: Shared memory transport is not available on this platform\n");
+	return false;
+#endif
+}
+
+void shm_ring_writer::close()
+{
+#ifdef __linux__
+	if (header)
+		munmap(header, map_size);
+	if (memfd >= 0)
+		::close(memfd);
+#endif
+	header = nullptr;
+	memfd = -1;
+}
+
+vban_shm_slot *shm_ring_writer::slot(uint64_t i) const noexcept
+{
+	uint8_t *base = reinterpret_cast<uint8_t *>(header) + header->slot_offset;
+	return reinterpret_cast<vban_shm_slot *>(base + (size_t)(i & (header->n_slots - 1)) * header->slot_size);
+}
+
+uint8_t *shm_ring_writer::begin() noexcept
+{
+	vban_shm_slot *s = slot(index);
+	s->seq.store(2 * index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	return s->packet;
+}
+
+void shm_ring_writer::commit(uint32_t size) noexcept
+{
+	vban_shm_slot *s = slot(index);
+	s->size = size;
+	s->seq.store(2 * index + 2, std::memory_order_release);
+	header->write_index.store(++index, std::memory_order_release);
+}
+
+shm_ring_reader::~shm_ring_reader()
+{
+	detach();
+}
+
+bool shm_ring_reader::attach(int fd)
+{
+#ifdef __linux__
+	detach();
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(vban_shm_header)) {
+		fprintf(stderr, "Error: Invalid shm ring\n");
+		return false;
+	}
+
+	void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "Error: Failed to map shm ring. errno=%d\n", errno);
+		return false;
+	}
+
+	auto *h = static_cast<const vban_shm_header *>(p);
+	if (h->magic != VBAN_SHM_MAGIC || h->version != VBAN_SHM_VERSION || !h->n_slots ||
+	    (h->n_slots & (h->n_slots - 1)) || h->slot_size < sizeof(vban_shm_slot) ||
+	    h->slot_offset + (size_t)h->slot_size * h->n_slots > (size_t)st.st_size) {
+		fprintf(stderr, "Error: Unknown shm ring layout\n");
+		munmap(p, (size_t)st.st_size);
+		return false;
+	}
+
+	header = h;
+	map_size = (size_t)st.st_size;
+	return true;
+#else
+	(void)fd;
+	return false;
+#endif
+}
+
+void shm_ring_reader::detach()
+{
+#ifdef __linux__
+	if (header)
+		munmap(const_cast<vban_shm_header *>(header), map_size);
+#endif
+	header = nullptr;
+}
+
+const vban_shm_slot *shm_ring_reader::slot(uint64_t i) const noexcept
+{
+	const uint8_t *base = reinterpret_cast<const uint8_t *>(header) + header->slot_offset;
+	return reinterpret_cast<const vban_shm_slot *>(base + (size_t)(i & (header->n_slots - 1)) * header->slot_size);
+}
+
+shm_ring_status shm_ring_reader::peek(uint64_t index, const uint8_t *&packet, uint32_t &size) const noexcept
+{
+	const vban_shm_slot *s = slot(index);
+	uint64_t seq = s->seq.load(std::memory_order_acquire);
+	if (seq != 2 * index + 2)
+		return seq < 2 * index + 2 ? shm_ring_empty : shm_ring_overrun;
+
+	packet = s->packet;
+	size = std::min<uint32_t>(s->size, header->slot_size - (uint32_t)sizeof(vban_shm_slot));
+	return shm_ring_ready;
+}
+
+bool shm_ring_reader::still_valid(uint64_t index) const noexcept
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot(index)->seq.load(std::memory_order_relaxed) == 2 * index + 2;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/* Ring of VBAN packets in a memfd shared with local readers.
+ *
+ * The sender is the only writer. Each slot holds one packet with the usual
+ * `VBanHeader` followed by the payload, so readers handle `nuFrame` and the
+ * format the same way as for UDP. Packets are not limited to the UDP payload
+ * size; a packet carries up to 256 frames as allowed by `format_nbs`.
+ *
+ * A slot is guarded by its sequence number: odd while the writer fills it,
+ * `2 * index + 2` once the packet `index` is complete. A reader may use the
+ * packet in place and checks the sequence again afterwards to detect that the
+ * writer has overwritten it in the meantime. */
+
+#define VBAN_SHM_MAGIC 0x4D485356 /* "VSHM" */
+#define VBAN_SHM_VERSION 1
+#define VBAN_SHM_ALIGN 64
+
+struct vban_shm_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t n_slots;   /* power of 2 */
+	uint32_t slot_size; /* bytes from one slot to the next */
+	uint32_t slot_offset;
+	uint32_t reserved[3];
+	alignas(VBAN_SHM_ALIGN) std::atomic<uint64_t> write_index; /* number of packets completed */
+};
+
+struct vban_shm_slot
+{
+	std::atomic<uint64_t> seq;
+	uint32_t size; /* bytes of the packet */
+	uint32_t reserved;
+	uint8_t packet[]; /* VBanHeader and payload */
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring needs address-free atomics");
+
+struct shm_ring_writer
+{
+	shm_ring_writer() = default;
+	~shm_ring_writer();
+
+	/* Creates the memfd and maps it. `packet_size_max` includes the VBAN header. */
+	bool create(uint32_t n_slots, uint32_t packet_size_max);
+	void close();
+	inline bool is_open() const noexcept
+	{
+		return header != nullptr;
+	}
+
+	/* The descriptor to be handed to readers, which map it read-only. */
+	inline int fd() const noexcept
+	{
+		return memfd;
+	}
+
+	inline uint32_t packet_size_max() const noexcept
+	{
+		return header ? header->slot_size - (uint32_t)sizeof(vban_shm_slot) : 0;
+	}
+
+	/* Returns the buffer of the next packet. It is published by `commit`. */
+	uint8_t *begin() noexcept;
+	void commit(uint32_t size) noexcept;
+
+private:
+	int memfd = -1;
+	size_t map_size = 0;
+	vban_shm_header *header = nullptr;
+	uint64_t index = 0;
+
+	vban_shm_slot *slot(uint64_t i) const noexcept;
+};
+
+enum shm_ring_status {
+	shm_ring_ready,
+	shm_ring_empty,   /* the packet is not written yet */
+	shm_ring_overrun, /* the packet was overwritten before it was read */
+};
+
+struct shm_ring_reader
+{
+	shm_ring_reader() = default;
+	~shm_ring_reader();
+
+	/* Maps the memfd received from the sender. The reader does not own `fd`. */
+	bool attach(int fd);
+	void detach();
+
+	inline uint64_t write_index() const noexcept
+	{
+		return header->write_index.load(std::memory_order_acquire);
+	}
+
+	inline uint32_t n_slots() const noexcept
+	{
+		return header->n_slots;
+	}
+
+	/* Returns the packet `index` in place. After it is used, `still_valid` tells whether the
+	 * writer has not overwritten it meanwhile. */
+	shm_ring_status peek(uint64_t index, const uint8_t *&packet, uint32_t &size) const noexcept;
+	bool still_valid(uint64_t index) const noexcept;
+
+private:
+	size_t map_size = 0;
+	const vban_shm_header *header = nullptr;
+
+	const vban_shm_slot *slot(uint64_t i) const noexcept;
+};
@@ -0,0 +1,156 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include "shm_transport.h"
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+static socklen_t abstract_address(struct sockaddr_un &addr, uint16_t port)
+{
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	/* The leading NUL selects the abstract namespace. */
+	int n = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "vban-shm-%u", port);
+	return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + n);
+}
+#endif
+
+shm_transport::~shm_transport()
+{
+	close();
+}
+
+bool shm_transport::open(uint16_t port_, uint32_t n_slots, uint32_t packet_size_max)
+{
+#ifdef __linux__
+	if (!ring.is_open() || ring.packet_size_max() < packet_size_max) {
+		if (!ring.create(n_slots, packet_size_max))
+			return false;
+	}
+
+	if (listen_fd >= 0 && port == port_)
+		return true;
+
+	if (listen_fd >= 0)
+		::close(listen_fd);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0) {
+		fprintf(stderr, "Error: Failed to create unix socket. errno=%d\n", errno);
+		return false;
+	}
+
+	struct sockaddr_un addr;
+	socklen_t len = abstract_address(addr, port_);
+	if (bind(listen_fd, (struct sockaddr *)&addr, len) != 0 || listen(listen_fd, 4) != 0) {
+		fprintf(stderr, "Error: Failed to listen on vban-shm-%u. errno=%d\n", port_, errno);
+		::close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+
+	port = port_;
+	return true;
+#else
+	(void)port_;
+	(void)n_slots;
+	(void)packet_size_max;
+	fprintf(stderr, "Error: Shared memory transport is not available on this platform\n");
+	return false;
+#endif
+}
+
+void shm_transport::close()
+{
+#ifdef __linux__
+	if (listen_fd >= 0)
+		::close(listen_fd);
+#endif
+	listen_fd = -1;
+	ring.close();
+}
+
+void shm_transport::serve_readers()
+{
+#ifdef __linux__
+	if (listen_fd < 0)
+		return;
+
+	int fd;
+	while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+		char byte = 0;
+		struct iovec iov = {&byte, 1};
+
+		union {
+			char buf[CMSG_SPACE(sizeof(int))];
+			struct cmsghdr align;
+		} control;
+		memset(&control, 0, sizeof(control));
+
+		struct msghdr msg = {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+		cm->cmsg_level = SOL_SOCKET;
+		cm->cmsg_type = SCM_RIGHTS;
+		cm->cmsg_len = CMSG_LEN(sizeof(int));
+		int memfd = ring.fd();
+		memcpy(CMSG_DATA(cm), &memfd, sizeof(int));
+
+		if (sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+			fprintf(stderr, "Error: Failed to hand shm ring to a reader. errno=%d\n", errno);
+		::close(fd);
+	}
+#endif
+}
+
+int shm_transport_connect(uint16_t port)
+{
+#ifdef __linux__
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	struct sockaddr_un addr;
+	socklen_t len = abstract_address(addr, port);
+	if (connect(fd, (struct sockaddr *)&addr, len) != 0) {
+		::close(fd);
+		return -1;
+	}
+
+	char byte;
+	struct iovec iov = {&byte, 1};
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+
+	struct msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	int memfd = -1;
+	if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) > 0) {
+		struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+		if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+			memcpy(&memfd, CMSG_DATA(cm), sizeof(int));
+	}
+
+	::close(fd);
+	return memfd;
+#else
+	(void)port;
+	return -1;
+#endif
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include "shm_ring.h"
+
+/* Where the sender thread delivers the packets. */
+enum vban_transport {
+	transport_udp = 0,
+	transport_shm, /* shm ring for readers on the same host */
+	transport_count,
+};
+
+/* Publishes VBAN packets into a shm ring for readers on the same host.
+ *
+ * Readers find the ring by the abstract unix socket "vban-shm-<port>", where
+ * the port is the destination port set on the plugin, and receive the memfd
+ * with SCM_RIGHTS. Available on Linux only. */
+struct shm_transport
+{
+	shm_transport() = default;
+	~shm_transport();
+
+	/* Creates the ring if needed and listens for readers of `port`. */
+	bool open(uint16_t port, uint32_t n_slots, uint32_t packet_size_max);
+	void close();
+	inline bool is_open() const noexcept
+	{
+		return ring.is_open() && listen_fd >= 0;
+	}
+
+	/* Hands the ring to the readers waiting to connect. Never blocks. */
+	void serve_readers();
+
+	shm_ring_writer ring;
+
+private:
+	int listen_fd = -1;
+	uint16_t port = 0;
+};
+
+/* Connects to the sender publishing for `port` and returns the memfd of its ring, or -1. */
+int shm_transport_connect(uint16_t port);
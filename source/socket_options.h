@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+/* Options of the sending socket, taken from the parameters. */
+struct socket_options
+{
+	bool txtime = false;    /* let the kernel launch packets at their scheduled time */
+	uint8_t dscp = 0;       /* DiffServ code point, 46 for EF */
+	uint8_t priority = 0;   /* SO_PRIORITY, selects the traffic class of the qdisc */
+	uint16_t sndbuf_kb = 0; /* 0 keeps the system default */
+
+	inline bool operator!=(const socket_options &x) const
+	{
+		return txtime != x.txtime || dscp != x.dscp || priority != x.priority || sndbuf_kb != x.sndbuf_kb;
+	}
+};
@@ -0,0 +1,166 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "socket_send.h"
+
+#ifdef __linux__
+#include <time.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#endif
+
+#if defined(__linux__) && defined(SO_TXTIME) && defined(SCM_TXTIME)
+#define HAVE_TXTIME 1
+#else
+#define HAVE_TXTIME 0
+#endif
+
+bool socket_options_apply(socket_t fd, const socket_options &opts)
+{
+#ifdef IP_TOS
+	if (opts.dscp) {
+		int tos = opts.dscp << 2;
+		if (setsockopt(fd, IPPROTO_IP, IP_TOS, (const char *)&tos, sizeof(tos)) != 0)
+			fprintf(stderr, "Error: Failed to set DSCP %u. errno=%d\n", opts.dscp, errno);
+	}
+#endif
+
+#ifdef SO_PRIORITY
+	if (opts.priority) {
+		int priority = opts.priority;
+		if (setsockopt(fd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority)) != 0)
+			fprintf(stderr, "Error: Failed to set socket priority %u. errno=%d\n", opts.priority, errno);
+	}
+#endif
+
+	if (opts.sndbuf_kb) {
+		int size = opts.sndbuf_kb * 1024;
+		if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const char *)&size, sizeof(size)) != 0)
+			fprintf(stderr, "Error: Failed to set send buffer to %u KiB. errno=%d\n", opts.sndbuf_kb, errno);
+	}
+
+	if (!opts.txtime)
+		return true;
+
+#if HAVE_TXTIME
+	struct sock_txtime txtime = {};
+	txtime.clockid = CLOCK_TAI;
+	txtime.flags = SOF_TXTIME_REPORT_ERRORS;
+	if (setsockopt(fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) == 0)
+		return true;
+	fprintf(stderr, "Error: Failed to enable SO_TXTIME. errno=%d\n", errno);
+#else
+	fprintf(stderr, "Error: SO_TXTIME is not available on this platform\n");
+#endif
+	return false;
+}
+
+uint64_t socket_txtime_from_steady(std::chrono::steady_clock::time_point t)
+{
+#if HAVE_TXTIME
+	/* libstdc++ and libc++ implement steady_clock with CLOCK_MONOTONIC. */
+	struct timespec mono, tai;
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_TAI, &tai);
+	int64_t offset = (tai.tv_sec - mono.tv_sec) * 1'000'000'000LL + (tai.tv_nsec - mono.tv_nsec);
+	return (uint64_t)(std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count() +
+			  offset);
+#else
+	return 0;
+#endif
+}
+
+int socket_sendto_txtime(socket_t fd, const void *data, size_t size, const struct sockaddr *addr,
+			 socklen_t addrlen, uint64_t txtime)
+{
+#if HAVE_TXTIME
+	struct iovec iov;
+	iov.iov_base = const_cast<void *>(data);
+	iov.iov_len = size;
+
+	union {
+		char buf[CMSG_SPACE(sizeof(uint64_t))];
+		struct cmsghdr align;
+	} control;
+	memset(&control, 0, sizeof(control));
+
+	struct msghdr msg = {};
+	msg.msg_name = const_cast<struct sockaddr *>(addr);
+	msg.msg_namelen = addrlen;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_TXTIME;
+	cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+	memcpy(CMSG_DATA(cm), &txtime, sizeof(txtime));
+
+	return (int)sendmsg(fd, &msg, 0);
+#else
+	(void)txtime;
+	return sendto(fd, data, size, 0, addr, addrlen);
+#endif
+}
+
+bool socket_source_address(socket_t fd, const struct sockaddr_in &dest, struct sockaddr_in &src)
+{
+	memset(&src, 0, sizeof(src));
+	src.sin_family = AF_INET;
+
+	struct sockaddr_in bound;
+	socklen_t len = sizeof(bound);
+	if (getsockname(fd, (struct sockaddr *)&bound, &len) != 0)
+		return false;
+	src.sin_port = bound.sin_port;
+	if (bound.sin_addr.s_addr != htonl(INADDR_ANY)) {
+		src.sin_addr = bound.sin_addr;
+		return src.sin_port != 0;
+	}
+
+	/* `fd` is not connected, the kernel selects the address for each packet. Connecting a probe
+	 * socket to the destination selects it the same way without sending anything. */
+	socket_t probe = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (!valid_socket(probe))
+		return false;
+	len = sizeof(bound);
+	bool ok = connect(probe, (const struct sockaddr *)&dest, (socklen_t)sizeof(dest)) == 0 &&
+		  getsockname(probe, (struct sockaddr *)&bound, &len) == 0;
+	if (ok)
+		src.sin_addr = bound.sin_addr;
+	closesocket(probe);
+	if (!ok)
+		fprintf(stderr, "Error: Failed to find the source address of the VBAN socket. errno=%d\n", errno);
+
+	return ok && src.sin_port != 0;
+}
+
+uint32_t socket_drain_txtime_errors(socket_t fd)
+{
+	uint32_t n = 0;
+#if HAVE_TXTIME
+	char buf[64];
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+	while (true) {
+		struct iovec iov = {buf, sizeof(buf)};
+		struct msghdr msg = {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			auto *err = reinterpret_cast<struct sock_extended_err *>(CMSG_DATA(cm));
+			if (err->ee_origin == SO_EE_ORIGIN_TXTIME)
+				n++;
+		}
+	}
+#else
+	(void)fd;
+#endif
+	return n;
+}
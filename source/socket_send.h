@@ -0,0 +1,28 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include "socket.h"
+#include "socket_options.h"
+
+/* Applies the options to a new socket. Returns false if SO_TXTIME was requested but is not
+ * available, in which case the caller has to pace the packets itself. SO_TXTIME is accepted
+ * whatever the qdisc is; without ETF on the egress interface the launch time is ignored and
+ * packets leave when they are handed over, which is ahead of time. */
+bool socket_options_apply(socket_t fd, const socket_options &opts);
+
+/* SO_TXTIME launch times are given on CLOCK_TAI, which is what the ETF qdisc uses by default. */
+uint64_t socket_txtime_from_steady(std::chrono::steady_clock::time_point t);
+
+/* Same as `sendto` with the launch time attached. */
+int socket_sendto_txtime(socket_t fd, const void *data, size_t size, const struct sockaddr *addr,
+			 socklen_t addrlen, uint64_t txtime);
+
+/* Finds the address and port `fd` sends from to `dest`. The port is known once `fd` has sent,
+ * the address is the one the kernel selects for the route to `dest`. Returns false, with the
+ * fields not found left zero, if either lookup fails. */
+bool socket_source_address(socket_t fd, const struct sockaddr_in &dest, struct sockaddr_in &src);
+
+/* Reads the packets the qdisc dropped for missing their launch time from the error queue.
+ * Returns the number of them. */
+uint32_t socket_drain_txtime_errors(socket_t fd);
@@ -0,0 +1,42 @@
+#pragma once
+
+/* Static tracepoints (USDT) in provider `vban`, built when `VBAN_ENABLE_USDT` is
+ * defined, see the option of the same name in CMakeLists.txt. Each probe is a
+ * single nop in the code and a note in the binary until a tracer attaches to
+ * it, so they stay in release builds. The arguments are evaluated regardless,
+ * they are integers at hand or a load away.
+ *
+ *   process_entry(n_samples, process_mode)      audio thread, `process()` starts
+ *   process_exit(n_samples, queued)             audio thread, `process()` returns
+ *   handoff(buffer, sequence, n_samples)        audio thread, a block is queued into
+ *                                               the `audio_buffer`, or dropped with
+ *                                               sequence 0
+ *   copy_packet(buffer, sequence, n_samples,    sender thread, the block is taken,
+ *               buffered)                       with the frames buffered before it
+ *   send(nu_frame, n_frames, bytes, due_ns)     sender thread, a packet is sent,
+ *                                               `due_ns` is the CLOCK_MONOTONIC time
+ *                                               it was scheduled at, 0 if none
+ *   wait(send_soon, deadline_ns)                sender thread, waits for blocks until
+ *                                               the CLOCK_MONOTONIC deadline, 0 if short,
+ *                                               ahead of `due_ns` by the lead for SO_TXTIME
+ *   wake(n_queued)                              sender thread, the wait returns
+ *   conceal(nu_frame, n_frames)                 sender thread, the packet is padded
+ *                                               for an underrun of the host
+ *
+ * Sample scripts are in tools/bpftrace. Without bpftrace, each probe can be added to
+ * `uprobe_events` in tracefs at the location `readelf -n` lists for it, with the arguments
+ * it lists in the fetch-arg syntax, such as `8@%rdx` as `%dx:u64` and `8@80(%rsp)` as
+ * `+80(%sp):u64`. With `trace_clock` set to `mono`, the timestamps compare to `due_ns`. */
+
+#ifdef VBAN_ENABLE_USDT
+#include <sys/sdt.h>
+#define VBAN_TRACE1(name, a) DTRACE_PROBE1(vban, name, a)
+#define VBAN_TRACE2(name, a, b) DTRACE_PROBE2(vban, name, a, b)
+#define VBAN_TRACE3(name, a, b, c) DTRACE_PROBE3(vban, name, a, b, c)
+#define VBAN_TRACE4(name, a, b, c, d) DTRACE_PROBE4(vban, name, a, b, c, d)
+#else
+#define VBAN_TRACE1(name, a) ((void)0)
+#define VBAN_TRACE2(name, a, b) ((void)0)
+#define VBAN_TRACE3(name, a, b, c) ((void)0)
+#define VBAN_TRACE4(name, a, b, c, d) ((void)0)
+#endif
@@ -2,9 +2,17 @@
 // Copyright(c) 2024 Nagater Networks.
 //------------------------------------------------------------------------
 
+#include <algorithm>
+#include <cstdio>
 #include "vban_controller.h"
 #include "vban_cids.h"
 #include "paramids.h"
+#include "vban_fec.h"
+#include "routing_matrix.h"
+#include "packetizer.h"
+#include "audio_buffer.h"
+#include "shm_transport.h"
+#include "aggregation.h"
 
 #include "base/source/fstreamer.h"
 
@@ -15,6 +23,14 @@ namespace NagaterNet {
 //------------------------------------------------------------------------
 // CVBANPluginController Implementation
 //------------------------------------------------------------------------
+static void ascii_to_string128(Vst::String128 dst, const char *src)
+{
+	size_t k = 0;
+	for (; src[k] && k < 127; k++)
+		dst[k] = src[k];
+	dst[k] = 0;
+}
+
 tresult PLUGIN_API CVBANPluginController::initialize(FUnknown *context)
 {
 	// Here the Plug-in will be instantiated
@@ -46,6 +62,127 @@ tresult PLUGIN_API CVBANPluginController::initialize(FUnknown *context)
 	param = new RangeParameter(STR16("Port"), paramid_port, nullptr, 0.0, 65535.0, 6980.0, 65535);
 	parameters.addParameter(param);
 
+	/* Number of packets protected by one parity packet, 0 disables FEC. */
+	param = new RangeParameter(STR16("FEC Group Size"), paramid_fec_group, nullptr, 0.0, VBAN_FEC_GROUP_MAX, 0.0,
+				   VBAN_FEC_GROUP_MAX);
+	parameters.addParameter(param);
+
+	param = new RangeParameter(STR16("VBAN Channels"), paramid_vban_channels, nullptr, 1.0, VBAN_ROUTE_MAX_OUT, 2.0,
+				   VBAN_ROUTE_MAX_OUT - 1);
+	parameters.addParameter(param);
+
+	auto *format_param = new Vst::StringListParameter(STR16("Sample Format"), paramid_format);
+	/* In the order of `packetizer_format_steps`. */
+	format_param->appendString(STR16("32-bit float"));
+	format_param->appendString(STR16("12-bit integer (packed)"));
+	format_param->appendString(STR16("10-bit integer (packed)"));
+	format_param->appendString(STR16("16-bit integer"));
+	format_param->appendString(STR16("16-bit integer (lossless)"));
+	format_param->appendString(STR16("24-bit integer (lossless)"));
+	format_param->appendString(STR16("24-bit integer"));
+	parameters.addParameter(format_param);
+
+	/* Applied when the sender thread falls behind, see audio_buffer_overflow_policy. */
+	auto *policy_param = new Vst::StringListParameter(STR16("Overflow Policy"), paramid_overflow_policy);
+	policy_param->appendString(STR16("Drop oldest"));
+	policy_param->appendString(STR16("Drop newest"));
+	policy_param->appendString(STR16("Resync"));
+	parameters.addParameter(policy_param);
+
+	/* Depth of the buffer kept by the sender thread, 0 learns the minimum safe one from the block jitter. */
+	param = new RangeParameter(STR16("Latency Target"), paramid_latency_target, STR16("ms"), 0.0,
+				   VBAN_LATENCY_TARGET_MAX_MS, 0.0, VBAN_LATENCY_TARGET_MAX_MS);
+	parameters.addParameter(param);
+
+	param = new RangeParameter(STR16("Latency"), paramid_latency, STR16("ms"), 0.0, VBAN_LATENCY_MAX_MS, 0.0,
+				   VBAN_LATENCY_MAX_MS, Vst::ParameterInfo::kIsReadOnly);
+	parameters.addParameter(param);
+
+	/* Hands packets to the kernel with their launch time, requires the ETF qdisc on Linux. */
+	auto *txtime_param = new Vst::StringListParameter(STR16("Kernel Pacing"), paramid_txtime);
+	txtime_param->appendString(STR16("Off"));
+	txtime_param->appendString(STR16("SO_TXTIME"));
+	parameters.addParameter(txtime_param);
+
+	param = new RangeParameter(STR16("DSCP"), paramid_dscp, nullptr, 0.0, 63.0, 0.0, 63);
+	parameters.addParameter(param);
+
+	param = new RangeParameter(STR16("Socket Priority"), paramid_so_priority, nullptr, 0.0, 7.0, 0.0, 7);
+	parameters.addParameter(param);
+
+	/* 0 keeps the system default. */
+	param = new RangeParameter(STR16("Send Buffer"), paramid_sndbuf, STR16("KiB"), 0.0, VBAN_SNDBUF_MAX_KB, 0.0,
+				   VBAN_SNDBUF_MAX_KB);
+	parameters.addParameter(param);
+
+	/* Shared memory publishes the packets for readers on the same host, see shm_transport. */
+	auto *transport_param = new Vst::StringListParameter(STR16("Transport"), paramid_transport);
+	transport_param->appendString(STR16("UDP"));
+	transport_param->appendString(STR16("Shared memory"));
+	parameters.addParameter(transport_param);
+
+	/* Instances in the same group are sent as one stream, see aggregation_group. */
+	param = new RangeParameter(STR16("Aggregation Group"), paramid_group, nullptr, 0.0, VBAN_GROUP_MAX, 0.0,
+				   VBAN_GROUP_MAX);
+	parameters.addParameter(param);
+
+	param = new RangeParameter(STR16("Aggregation Channel"), paramid_group_offset, nullptr, 1.0,
+				   VBAN_GROUP_MAX_CHANNELS, 1.0, VBAN_GROUP_MAX_CHANNELS - 1);
+	parameters.addParameter(param);
+
+	/* Bypass leaves the output buffers untouched, only for hosts that do not use them or
+	 * process in place; see `output_bypass`. */
+	auto *output_param = new Vst::StringListParameter(STR16("Output"), paramid_output_mode);
+	output_param->appendString(STR16("Pass-through"));
+	output_param->appendString(STR16("Mute"));
+	output_param->appendString(STR16("Bypass"));
+	parameters.addParameter(output_param);
+
+	/* Applied while the host renders faster than real time, see vban_offline_mode. */
+	auto *offline_param = new Vst::StringListParameter(STR16("Offline Rendering"), paramid_offline_mode);
+	offline_param->appendString(STR16("Throttle"));
+	offline_param->appendString(STR16("Burst"));
+	offline_param->appendString(STR16("Suspend"));
+	parameters.addParameter(offline_param);
+
+	/* Writes the sent packets to a pcap file in the temporary directory, or to `VBAN_CAPTURE_FILE`. */
+	auto *capture_param = new Vst::StringListParameter(STR16("Packet Capture"), paramid_capture);
+	capture_param->appendString(STR16("Off"));
+	capture_param->appendString(STR16("On"));
+	parameters.addParameter(capture_param);
+
+	for (uint32_t o = 0; o < VBAN_ROUTE_MAX_OUT; o++) {
+		for (uint32_t i = 0; i < VBAN_ROUTE_MAX_IN; i++) {
+			Vst::String128 title;
+			char title_ascii[64];
+			snprintf(title_ascii, sizeof(title_ascii), "Gain In %u to VBAN %u", i + 1, o + 1);
+			ascii_to_string128(title, title_ascii);
+
+			param = new RangeParameter(title, paramid_route_gain + o * VBAN_ROUTE_MAX_IN + i, nullptr, 0.0,
+						   1.0, o == i ? 1.0 : 0.0);
+			parameters.addParameter(param);
+		}
+	}
+
+	/* Levels of the host input channels before the routing matrix, reported by the processor.
+	 * They are not the levels of the VBAN channels when gains or fold-down are applied.
+	 * Metering is not free: `process` spends about 40 ns per 256 samples on each captured
+	 * channel on top of the copy, which alone takes about 17 ns, and about 60 ns reading
+	 * each channel that is not captured or in a block not queued. */
+	for (uint32_t i = 0; i < VBAN_ROUTE_MAX_IN; i++) {
+		for (int rms = 0; rms < 2; rms++) {
+			Vst::String128 title;
+			char title_ascii[64];
+			snprintf(title_ascii, sizeof(title_ascii), "Input %s %u", rms ? "RMS" : "Peak", i + 1);
+			ascii_to_string128(title, title_ascii);
+
+			param = new RangeParameter(title, (rms ? paramid_level_rms : paramid_level_peak) + i,
+						   STR16("dB"), VBAN_LEVEL_FLOOR_DB, 0.0, VBAN_LEVEL_FLOOR_DB, 0,
+						   Vst::ParameterInfo::kIsReadOnly);
+			parameters.addParameter(param);
+		}
+	}
+
 	return result;
 }
 
@@ -69,6 +206,7 @@ tresult PLUGIN_API CVBANPluginController::setComponentState(IBStream *state)
 
 	uint32_t dest_addr = 0;
 	uint16_t dest_port = 0;
+	uint8_t fec_group = 0;
 
 	uint32_t version = 0;
 	streamer.readInt32u(version);
@@ -80,12 +218,93 @@ tresult PLUGIN_API CVBANPluginController::setComponentState(IBStream *state)
 
 	streamer.readInt32u(dest_addr);
 	streamer.readInt16u(dest_port);
+	if (version_minor >= 1)
+		streamer.readInt8u(fec_group);
+
+	routing_matrix routing;
+	if (version_minor >= 2) {
+		uint8_t n_out = 0;
+		if (streamer.readInt8u(n_out))
+			routing.n_out = std::clamp<uint32_t>(n_out, 1, VBAN_ROUTE_MAX_OUT);
+		for (uint32_t o = 0; o < VBAN_ROUTE_MAX_OUT; o++) {
+			for (uint32_t i = 0; i < VBAN_ROUTE_MAX_IN; i++)
+				streamer.readFloat(routing.gain[o][i]);
+		}
+	}
+
+	uint8_t format = 0;
+	if (version_minor >= 3)
+		streamer.readInt8u(format);
+
+	uint8_t policy = 0;
+	if (version_minor >= 4)
+		streamer.readInt8u(policy);
+
+	uint16_t latency_target = 0;
+	if (version_minor >= 5)
+		streamer.readInt16u(latency_target);
+
+	uint8_t txtime = 0, dscp = 0, priority = 0;
+	uint16_t sndbuf_kb = 0;
+	if (version_minor >= 6) {
+		streamer.readInt8u(txtime);
+		streamer.readInt8u(dscp);
+		streamer.readInt8u(priority);
+		streamer.readInt16u(sndbuf_kb);
+	}
+
+	uint8_t transport = 0;
+	if (version_minor >= 7)
+		streamer.readInt8u(transport);
+
+	uint8_t group = 0, group_offset = 0;
+	if (version_minor >= 8) {
+		streamer.readInt8u(group);
+		streamer.readInt8u(group_offset);
+	}
+
+	uint8_t output_mode = 0;
+	if (version_minor >= 9)
+		streamer.readInt8u(output_mode);
+
+	uint8_t offline_mode = 0;
+	if (version_minor >= 10)
+		streamer.readInt8u(offline_mode);
+
+	uint8_t capture = 0;
+	if (version_minor >= 11)
+		streamer.readInt8u(capture);
 
 	setParamNormalized(paramid_ipv4_0, ((dest_addr >> 24) & 0xFF) / 255.0);
 	setParamNormalized(paramid_ipv4_1, ((dest_addr >> 16) & 0xFF) / 255.0);
 	setParamNormalized(paramid_ipv4_2, ((dest_addr >> 8) & 0xFF) / 255.0);
 	setParamNormalized(paramid_ipv4_3, ((dest_addr >> 0) & 0xFF) / 255.0);
 	setParamNormalized(paramid_port, dest_port / 65535.0);
+	setParamNormalized(paramid_fec_group, (double)fec_group / VBAN_FEC_GROUP_MAX);
+	setParamNormalized(paramid_vban_channels, (routing.n_out - 1.0) / (VBAN_ROUTE_MAX_OUT - 1));
+	for (uint32_t o = 0; o < VBAN_ROUTE_MAX_OUT; o++) {
+		for (uint32_t i = 0; i < VBAN_ROUTE_MAX_IN; i++)
+			setParamNormalized(paramid_route_gain + o * VBAN_ROUTE_MAX_IN + i, routing.gain[o][i]);
+	}
+	const uint8_t format_bit = packetizer_formats[std::min<size_t>(format, PACKETIZER_N_FORMATS - 1)];
+	setParamNormalized(paramid_format, (double)packetizer_format_step(format_bit) / (PACKETIZER_N_FORMATS - 1));
+	setParamNormalized(paramid_overflow_policy, std::min<double>(policy, overflow_policy_count - 1) /
+							    (overflow_policy_count - 1));
+	setParamNormalized(paramid_latency_target,
+			   std::min<double>(latency_target, VBAN_LATENCY_TARGET_MAX_MS) / VBAN_LATENCY_TARGET_MAX_MS);
+	setParamNormalized(paramid_txtime, txtime ? 1.0 : 0.0);
+	setParamNormalized(paramid_dscp, std::min<double>(dscp, 63) / 63);
+	setParamNormalized(paramid_so_priority, std::min<double>(priority, 7) / 7);
+	setParamNormalized(paramid_sndbuf, std::min<double>(sndbuf_kb, VBAN_SNDBUF_MAX_KB) / VBAN_SNDBUF_MAX_KB);
+	setParamNormalized(paramid_transport, std::min<double>(transport, transport_count - 1) / (transport_count - 1));
+	setParamNormalized(paramid_group, std::min<double>(group, VBAN_GROUP_MAX) / VBAN_GROUP_MAX);
+	setParamNormalized(paramid_group_offset,
+			   std::min<double>(group_offset, VBAN_GROUP_MAX_CHANNELS - 1) / (VBAN_GROUP_MAX_CHANNELS - 1));
+	setParamNormalized(paramid_output_mode,
+			   std::min<double>(output_mode, output_mode_count - 1) / (output_mode_count - 1));
+	setParamNormalized(paramid_offline_mode,
+			   std::min<double>(offline_mode, offline_mode_count - 1) / (offline_mode_count - 1));
+	setParamNormalized(paramid_capture, capture ? 1.0 : 0.0);
 
 	return kResultOk;
 }
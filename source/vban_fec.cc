@@ -0,0 +1,161 @@
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+
+#include "vban_fec.h"
+
+static const size_t nu_frame_offset = offsetof(VBanHeader, nuFrame);
+
+static inline uint32_t packet_nu_frame(const uint8_t *packet)
+{
+	uint32_t nu_frame;
+	memcpy(&nu_frame, packet + nu_frame_offset, sizeof(nu_frame));
+	return nu_frame;
+}
+
+static inline void set_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+}
+
+static inline uint16_t get_le16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline void xor_packet(uint8_t *dst, const uint8_t *packet, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++)
+		dst[i] ^= packet[i];
+
+	/* `nuFrame` does not take part in the parity. */
+	for (size_t i = 0; i < sizeof(uint32_t); i++)
+		dst[nu_frame_offset + i] ^= packet[nu_frame_offset + i];
+}
+
+void vban_fec_encoder::reset(uint32_t group_size_)
+{
+	group_size = group_size_ > 1 ? std::min<uint32_t>(group_size_, VBAN_FEC_GROUP_MAX) : 0;
+	n_added = 0;
+}
+
+uint32_t vban_fec_encoder::add(const uint8_t *packet, uint32_t size)
+{
+	if (!group_size || size < VBAN_HEADER_SIZE || size > VBAN_PROTOCOL_MAX_SIZE)
+		return 0;
+
+	uint32_t nu_frame = packet_nu_frame(packet);
+
+	if (nu_frame % group_size == 0) {
+		/* Start a new group, abandoning an incomplete one. */
+		n_added = 0;
+		max_size = 0;
+		size_xor = 0;
+		memset(block, 0, sizeof(block));
+		memcpy(parity_packet, packet, VBAN_HEADER_SIZE);
+	} else if (n_added == 0 || nu_frame % group_size != n_added) {
+		/* Not aligned to a group yet, or a packet was skipped. */
+		n_added = 0;
+		return 0;
+	}
+
+	xor_packet(block, packet, size);
+	max_size = std::max(max_size, size);
+	size_xor ^= (uint16_t)size;
+
+	if (++n_added < group_size)
+		return 0;
+
+	n_added = 0;
+
+	auto *header = reinterpret_cast<VBanHeader *>(parity_packet);
+	header->format_bit = (header->format_bit & ~VBAN_CODEC_MASK) | VBAN_CODEC_USER;
+
+	vban_fec_header fec;
+	fec.magic = VBAN_FEC_MAGIC;
+	fec.group_size = (uint8_t)group_size;
+	set_le16(fec.size_xor, size_xor);
+	memcpy(parity_packet + VBAN_HEADER_SIZE, &fec, sizeof(fec));
+	memcpy(parity_packet + VBAN_FEC_OVERHEAD, block, max_size);
+
+	return VBAN_FEC_OVERHEAD + max_size;
+}
+
+vban_fec_decoder::vban_fec_decoder()
+{
+	for (auto &s : slots) {
+		s.valid = false;
+		s.recovered = false;
+	}
+}
+
+vban_fec_decoder::slot &vban_fec_decoder::store(uint32_t nu_frame, const uint8_t *packet, uint32_t size)
+{
+	slot &s = slots[nu_frame % n_slots];
+	s.nu_frame = nu_frame;
+	s.size = (uint16_t)size;
+	s.valid = true;
+	s.recovered = false;
+	memcpy(s.data, packet, size);
+	return s;
+}
+
+bool vban_fec_decoder::add_data(const uint8_t *packet, uint32_t size)
+{
+	if (size < VBAN_HEADER_SIZE || size > VBAN_PROTOCOL_MAX_SIZE)
+		return true;
+
+	uint32_t nu_frame = packet_nu_frame(packet);
+	slot &s = slots[nu_frame % n_slots];
+	if (s.valid && s.nu_frame == nu_frame && s.recovered) {
+		s.recovered = false;
+		return false;
+	}
+
+	store(nu_frame, packet, size);
+	return true;
+}
+
+uint32_t vban_fec_decoder::add_parity(const uint8_t *packet, uint32_t size, uint8_t *recovered)
+{
+	if (size < VBAN_FEC_OVERHEAD)
+		return 0;
+
+	vban_fec_header fec;
+	memcpy(&fec, packet + VBAN_HEADER_SIZE, sizeof(fec));
+	if (fec.magic != VBAN_FEC_MAGIC || fec.group_size < 2 || fec.group_size > VBAN_FEC_GROUP_MAX)
+		return 0;
+
+	const uint32_t base = packet_nu_frame(packet);
+	const uint32_t block_size = size - VBAN_FEC_OVERHEAD;
+
+	uint8_t block[VBAN_PROTOCOL_MAX_SIZE] = {};
+	memcpy(block, packet + VBAN_FEC_OVERHEAD, std::min<uint32_t>(block_size, VBAN_PROTOCOL_MAX_SIZE));
+	uint16_t size_xor = get_le16(fec.size_xor);
+
+	uint32_t n_missing = 0;
+	uint32_t missing = 0;
+	for (uint32_t i = 0; i < fec.group_size; i++) {
+		const slot &s = slots[(base + i) % n_slots];
+		if (!s.valid || s.nu_frame != base + i) {
+			n_missing++;
+			missing = base + i;
+			continue;
+		}
+		xor_packet(block, s.data, s.size);
+		size_xor ^= s.size;
+	}
+
+	if (n_missing > 1)
+		n_unrecoverable++;
+	if (n_missing != 1 || size_xor < VBAN_HEADER_SIZE || size_xor > block_size)
+		return 0;
+
+	memcpy(block + nu_frame_offset, &missing, sizeof(missing));
+	store(missing, block, size_xor).recovered = true;
+	memcpy(recovered, block, size_xor);
+	n_recovered++;
+
+	return size_xor;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include "vban.h"
+
+/* XOR parity over groups of `group_size` consecutive VBAN packets.
+ *
+ * A group starts at a packet whose `nuFrame` is a multiple of the group size.
+ * When the group completes, a parity packet is emitted on the companion port
+ * (the data port + 1). The parity packet is the VBAN header of the first packet
+ * of the group with `VBAN_CODEC_USER` set, followed by `vban_fec_header` and the
+ * XOR of all packets in the group with their `nuFrame` field cleared. A receiver
+ * that lost exactly one packet of a group rebuilds it from the others. */
+
+#define VBAN_FEC_MAGIC 0x46 /* 'F' */
+#define VBAN_FEC_GROUP_MAX 32
+#define VBAN_FEC_PORT_OFFSET 1
+
+struct vban_fec_header
+{
+	uint8_t magic;
+	uint8_t group_size;
+	uint8_t size_xor[2]; /* little endian, XOR of the sizes of the packets */
+};
+
+#define VBAN_FEC_OVERHEAD (VBAN_HEADER_SIZE + sizeof(vban_fec_header))
+
+struct vban_fec_encoder
+{
+	void reset(uint32_t group_size);
+
+	inline uint32_t get_group_size() const
+	{
+		return group_size;
+	}
+
+	/* Adds a data packet. Returns the size of the parity packet when the
+	 * packet completes a group, otherwise 0. */
+	uint32_t add(const uint8_t *packet, uint32_t size);
+
+	inline const uint8_t *parity() const
+	{
+		return parity_packet;
+	}
+
+private:
+	uint32_t group_size = 0;
+	uint32_t n_added = 0;
+	uint32_t max_size = 0;
+	uint16_t size_xor = 0;
+	uint8_t block[VBAN_PROTOCOL_MAX_SIZE];
+	uint8_t parity_packet[VBAN_FEC_OVERHEAD + VBAN_PROTOCOL_MAX_SIZE];
+};
+
+struct vban_fec_decoder
+{
+	vban_fec_decoder();
+
+	/* Records a received data packet. Returns false if the packet was
+	 * already rebuilt from parity, ie. it is a duplicate for the caller. */
+	bool add_data(const uint8_t *packet, uint32_t size);
+
+	/* Processes a parity packet. If exactly one packet of the group is
+	 * missing, it is rebuilt into `recovered` and its size is returned. */
+	uint32_t add_parity(const uint8_t *packet, uint32_t size, uint8_t *recovered);
+
+	uint64_t n_recovered = 0;
+	uint64_t n_unrecoverable = 0; /* groups with more than one packet lost */
+
+private:
+	static const uint32_t n_slots = 256;
+
+	struct slot
+	{
+		uint32_t nu_frame;
+		uint16_t size;
+		bool valid;
+		bool recovered;
+		uint8_t data[VBAN_PROTOCOL_MAX_SIZE];
+	};
+
+	slot slots[n_slots];
+
+	slot &store(uint32_t nu_frame, const uint8_t *packet, uint32_t size);
+};
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "vban_lossless.h"
+#include "bit_writer.h"
+
+/* Packets have at most 256 frames, `format_nbs` is 8 bits. */
+static const uint32_t max_frames = 256;
+
+static inline uint32_t zigzag(int32_t r) noexcept
+{
+	return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u) noexcept
+{
+	return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+struct rice_reader
+{
+	const uint8_t *src;
+	const uint8_t *end;
+	uint64_t acc = 0;
+	uint32_t n_bits = 0;
+
+	inline void fill() noexcept
+	{
+		for (; n_bits <= 56 && src < end; n_bits += 8)
+			acc |= (uint64_t)*src++ << n_bits;
+	}
+
+	inline bool get(uint32_t bits, uint32_t &v) noexcept
+	{
+		if (n_bits < bits)
+			fill();
+		if (n_bits < bits)
+			return false;
+		v = (uint32_t)(acc & ((1ULL << bits) - 1));
+		acc = bits < 64 ? acc >> bits : 0;
+		n_bits -= bits;
+		return true;
+	}
+
+	/* Fails on quotients above `limit`, which the encoder does not write. */
+	inline bool get_unary(uint32_t &q, uint32_t limit) noexcept
+	{
+		q = 0;
+		while (true) {
+			if (!acc) {
+				q += n_bits;
+				acc = 0;
+				n_bits = 0;
+				fill();
+				if (!n_bits || q > limit)
+					return false;
+				continue;
+			}
+			uint32_t tz = (uint32_t)__builtin_ctzll(acc);
+			q += tz;
+			acc = tz + 1 < 64 ? acc >> (tz + 1) : 0;
+			n_bits -= tz + 1;
+			return q <= limit;
+		}
+	}
+};
+
+/* Bits of the residuals written with the Rice parameter `k`. */
+static inline uint64_t rice_bits(const uint32_t *u, uint32_t n, uint32_t k) noexcept
+{
+	uint64_t bits = (uint64_t)n * (k + 1);
+	for (uint32_t i = 0; i < n; i++)
+		bits += u[i] >> k;
+	return bits;
+}
+
+static void put_samples(const int32_t *x, uint32_t n, uint32_t bits, bit_writer &w)
+{
+	for (uint32_t i = 0; i < n; i++)
+		w.put((uint32_t)x[i] & ((1u << bits) - 1), bits);
+}
+
+static void encode_channel(const int32_t *x, uint32_t n, uint32_t bits, bit_writer &w)
+{
+	if (n <= VBAN_LOSSLESS_MAX_ORDER) {
+		w.put(3, 2);
+		put_samples(x, n, bits, w);
+		return;
+	}
+
+	/* Picks the predictor with the smallest sum of residuals over the samples all of them predict. */
+	uint64_t sum[VBAN_LOSSLESS_MAX_ORDER + 1] = {};
+	for (uint32_t i = VBAN_LOSSLESS_MAX_ORDER; i < n; i++) {
+		sum[0] += (uint32_t)std::abs(x[i]);
+		sum[1] += (uint32_t)std::abs(x[i] - x[i - 1]);
+		sum[2] += (uint32_t)std::abs(x[i] - 2 * x[i - 1] + x[i - 2]);
+	}
+	uint32_t order = 0;
+	for (uint32_t o = 1; o <= VBAN_LOSSLESS_MAX_ORDER; o++) {
+		if (sum[o] < sum[order])
+			order = o;
+	}
+
+	uint32_t u[max_frames];
+	uint32_t n_res = 0;
+	uint64_t u_sum = 0;
+	for (uint32_t i = order; i < n; i++) {
+		int32_t r = order == 0 ? x[i] : order == 1 ? x[i] - x[i - 1] : x[i] - 2 * x[i - 1] + x[i - 2];
+		u[n_res] = zigzag(r);
+		u_sum += u[n_res++];
+	}
+
+	/* The parameter of about the mean is close to the best, one above is tried too. */
+	uint32_t k = 0;
+	while (k < 30 && ((uint64_t)n_res << (k + 1)) <= u_sum)
+		k++;
+	uint64_t cost = rice_bits(u, n_res, k);
+	uint64_t cost_up = rice_bits(u, n_res, k + 1);
+	if (cost_up < cost) {
+		cost = cost_up;
+		k++;
+	}
+
+	if (5 + order * bits + cost >= (uint64_t)n * bits) {
+		w.put(3, 2);
+		put_samples(x, n, bits, w);
+		return;
+	}
+
+	w.put(order, 2);
+	w.put(k, 5);
+	put_samples(x, order, bits, w);
+	for (uint32_t i = 0; i < n_res; i++) {
+		w.put_unary(u[i] >> k);
+		w.put(u[i] & ((1u << k) - 1), k);
+	}
+}
+
+uint32_t vban_lossless_encode(const float *src, uint32_t n_channels, uint32_t n_frames, uint32_t bits, uint8_t *dst)
+{
+	const float scale = (float)(1u << (bits - 1));
+	n_frames = std::min(n_frames, max_frames);
+
+	dst[0] = VBAN_LOSSLESS_MAGIC;
+	bit_writer w{dst + 1};
+
+	int32_t x[max_frames];
+	for (uint32_t ch = 0; ch < n_channels; ch++) {
+		for (uint32_t i = 0; i < n_frames; i++)
+			x[i] = float_to_int(src[i * n_channels + ch], scale);
+		encode_channel(x, n_frames, bits, w);
+	}
+
+	w.finish();
+	return (uint32_t)(w.dst - dst);
+}
+
+bool vban_lossless_decode(const uint8_t *src, uint32_t size, uint32_t n_channels, uint32_t n_frames, uint32_t bits,
+			  int32_t *dst)
+{
+	if (size < 1 || src[0] != VBAN_LOSSLESS_MAGIC || bits < 2 || bits > 24)
+		return false;
+
+	const int32_t lo = -(1 << (bits - 1));
+	const int32_t hi = (1 << (bits - 1)) - 1;
+	const uint32_t shift = 32 - bits;
+	rice_reader r{src + 1, src + size};
+
+	for (uint32_t ch = 0; ch < n_channels; ch++) {
+		int32_t *x = dst + ch;
+		uint32_t order, v;
+		if (!r.get(2, order))
+			return false;
+
+		if (order > VBAN_LOSSLESS_MAX_ORDER) {
+			for (uint32_t i = 0; i < n_frames; i++) {
+				if (!r.get(bits, v))
+					return false;
+				x[i * n_channels] = (int32_t)(v << shift) >> shift;
+			}
+			continue;
+		}
+
+		uint32_t k;
+		if (!r.get(5, k))
+			return false;
+		const uint32_t limit = (uint32_t)((1ULL << (bits + 3)) >> k);
+
+		for (uint32_t i = 0; i < n_frames; i++) {
+			int64_t s;
+			if (i < order) {
+				if (!r.get(bits, v))
+					return false;
+				s = (int32_t)(v << shift) >> shift;
+			} else {
+				uint32_t q, rem;
+				if (!r.get_unary(q, limit) || !r.get(k, rem))
+					return false;
+				int64_t res = unzigzag((uint32_t)(((uint64_t)q << k) | rem));
+				int64_t x1 = i >= 1 ? x[(i - 1) * n_channels] : 0;
+				int64_t x2 = i >= 2 ? x[(i - 2) * n_channels] : 0;
+				s = res + (order == 0 ? 0 : order == 1 ? x1 : 2 * x1 - x2);
+				if (s < lo || s > hi)
+					return false;
+			}
+			x[i * n_channels] = (int32_t)s;
+		}
+	}
+
+	return true;
+}
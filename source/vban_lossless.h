@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include "vban.h"
+
+/* Lossless compression of PCM packets, sent as `VBAN_CODEC_USER` with the bit
+ * resolution of the PCM samples, 16 or 24-bit integer.
+ *
+ * Each packet is compressed on its own, so it can be decoded without the
+ * previous ones. The payload starts with `VBAN_LOSSLESS_MAGIC`, then the
+ * channels one after another as a bit stream written from the least
+ * significant bit, like the packed formats. Each channel starts with 2 bits:
+ *
+ *  - 0 to 2: the order of a fixed polynomial predictor, followed by 5 bits of
+ *    the Rice parameter `k`, the first `order` samples verbatim, and the
+ *    residuals of the others. A residual is mapped to an unsigned value
+ *    (0, -1, 1, -2, ... to 0, 1, 2, 3, ...), written as the quotient by `2^k`
+ *    in unary (zero bits terminated by a one bit) and the remainder in `k` bits.
+ *  - 3: the samples verbatim.
+ *
+ * Verbatim samples are two's complement values of the bit resolution. The
+ * last byte is padded with zero bits. A channel is written verbatim when its
+ * residuals take more bits, so the payload never exceeds the PCM payload by
+ * more than `VBAN_LOSSLESS_HEADER_BITS` and `VBAN_LOSSLESS_CHANNEL_BITS` per
+ * channel. */
+
+#define VBAN_LOSSLESS_MAGIC 0x4C /* 'L' */
+#define VBAN_LOSSLESS_HEADER_BITS 8
+#define VBAN_LOSSLESS_CHANNEL_BITS 2
+#define VBAN_LOSSLESS_MAX_ORDER 2
+
+/* Quantizes `n_frames` interleaved float frames to `bits`, as the PCM formats
+ * do, and compresses them into `dst`. `n_frames` is at most 256. Returns the
+ * bytes written. */
+uint32_t vban_lossless_encode(const float *src, uint32_t n_channels, uint32_t n_frames, uint32_t bits,
+			      uint8_t *dst);
+
+/* Decodes the payload of `size` bytes into interleaved samples. Returns false
+ * if the payload is not a valid packet of this layout. */
+bool vban_lossless_decode(const uint8_t *src, uint32_t size, uint32_t n_channels, uint32_t n_frames,
+			  uint32_t bits, int32_t *dst);
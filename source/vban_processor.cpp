@@ -2,9 +2,16 @@
 // Copyright(c) 2024 Nagater Networks.
 //------------------------------------------------------------------------
 
+#include <atomic>
+#include <cmath>
+#include <string>
+#include <thread>
 #include "vban_processor.h"
 #include "vban_cids.h"
 #include "paramids.h"
+#include "vban_fec.h"
+#include "packetizer.h"
+#include "trace.h"
 
 #include "base/source/fstreamer.h"
 #include "pluginterfaces/vst/ivstparameterchanges.h"
@@ -18,6 +25,15 @@ CVBANPluginProcessor::CVBANPluginProcessor()
 {
 	//--- set the wanted controller for our processor
 	setControllerClass(kCVBANPluginControllerUID);
+
+	capture_mask.store(routing.input_mask(VBAN_ROUTE_MAX_IN), std::memory_order_relaxed);
+	vban_format = packetizer_formats[0];
+
+	static std::atomic<uint32_t> n_instances{0};
+	capture_index = n_instances++;
+
+	for (auto &levels : levels_reported)
+		std::fill(std::begin(levels), std::end(levels), -1.0f);
 }
 
 CVBANPluginProcessor::~CVBANPluginProcessor()
@@ -41,31 +57,146 @@ tresult PLUGIN_API CVBANPluginProcessor::initialize(FUnknown *context)
 	addAudioInput(STR16("Stereo In"), Steinberg::Vst::SpeakerArr::kStereo);
 	addAudioOutput(STR16("Stereo Out"), Steinberg::Vst::SpeakerArr::kStereo);
 
+	/* The sender thread paces packets by the host's timeline if available. */
+	processContextRequirements.needSystemTime();
+	processContextRequirements.needContinousTimeSamples();
+
 	return kResultOk;
 }
 
+void CVBANPluginProcessor::capture_open(size_t ring_size)
+{
+	/* Capture of the outgoing stream is enabled by `paramid_capture`. The file is
+	 * `vban-capture-%u.pcap` in the temporary directory unless the environment variable
+	 * `VBAN_CAPTURE_FILE` gives another path. The first `%u` in the path is replaced with
+	 * an index unique to this instance. The file is kept open while the loop restarts. */
+	if (capture.is_open()) {
+		capture.grow_ring(ring_size);
+		return;
+	}
+
+	std::string path;
+	if (const char *env = getenv("VBAN_CAPTURE_FILE"); env && *env) {
+		path = env;
+	} else {
+#ifdef _WIN32
+		const char *dir = getenv("TEMP"), *dir_default = ".";
+		const char sep = '\\';
+#else
+		const char *dir = getenv("TMPDIR"), *dir_default = "/tmp";
+		const char sep = '/';
+#endif
+		path = dir && *dir ? dir : dir_default;
+		if (path.back() != sep)
+			path += sep;
+		path += "vban-capture-%u.pcap";
+	}
+
+	size_t pos = path.find("%u");
+	if (pos != std::string::npos)
+		path.replace(pos, 2, std::to_string(capture_index));
+
+	if (capture.open(path.c_str(), ring_size))
+		fprintf(stderr, "Info: VBAN packet capture to '%s'\n", path.c_str());
+}
+
 tresult PLUGIN_API CVBANPluginProcessor::terminate()
 {
 	// Here the Plug-in will be de-instantiated, last possibility to remove some memory!
 
+	/* The sender thread pushes to the capture, stop it first. */
+	if (cont)
+		thread_stop();
+	capture.close();
+	print_stats();
+
 	//---do not forget to call parent ------
 	return AudioEffect::terminate();
 }
 
+void CVBANPluginProcessor::print_stats()
+{
+	uint64_t n_dropped = packets.n_dropped_oldest + packets.n_dropped_newest + packets.n_resyncs;
+	if (stats.n_txtime_dropped)
+		fprintf(stderr, "Warning: VBAN qdisc dropped %llu packets that missed their launch time\n",
+			(unsigned long long)stats.n_txtime_dropped);
+
+	if (stats.n_group_dropped_frames || stats.n_group_partial_chunks || stats.n_group_resyncs)
+		fprintf(stderr,
+			"Warning: VBAN aggregation: %llu frames dropped, %llu chunks with silent members, %llu resyncs\n",
+			(unsigned long long)stats.n_group_dropped_frames, (unsigned long long)stats.n_group_partial_chunks,
+			(unsigned long long)stats.n_group_resyncs);
+
+	if (stats.n_underruns || stats.n_underrun_pauses)
+		fprintf(stderr,
+			"Warning: VBAN host underruns: %llu concealed with %llu frames, %llu late frames discarded, "
+			"%llu too long to conceal\n",
+			(unsigned long long)stats.n_underruns, (unsigned long long)stats.n_concealed_frames,
+			(unsigned long long)stats.n_late_frames, (unsigned long long)stats.n_underrun_pauses);
+
+	if (stats.n_discontinuities)
+		fprintf(stderr, "Info: VBAN sender restarted prebuffering at %llu host timeline discontinuities\n",
+			(unsigned long long)stats.n_discontinuities);
+
+	if (!n_dropped && !stats.n_backlog_resyncs)
+		return;
+
+	fprintf(stderr,
+		"Warning: VBAN sender overloaded: %llu blocks dropped (oldest), %llu blocks dropped (newest), "
+		"%llu queue resyncs, %llu backlog resyncs, %llu frames skipped in %llu packets\n",
+		(unsigned long long)packets.n_dropped_oldest, (unsigned long long)packets.n_dropped_newest,
+		(unsigned long long)packets.n_resyncs, (unsigned long long)stats.n_backlog_resyncs,
+		(unsigned long long)stats.n_skipped_frames, (unsigned long long)stats.n_packets);
+}
+
 tresult PLUGIN_API CVBANPluginProcessor::setActive(TBool state)
 {
 	//--- called when the Plug-in is enable/disable (On/Off) -----
 	return AudioEffect::setActive(state);
 }
 
+tresult PLUGIN_API CVBANPluginProcessor::setProcessing(TBool state)
+{
+	/* No more blocks are coming, the sender thread waits for them instead of concealing. */
+	if (!state)
+		packets.realtime.store(false, std::memory_order_relaxed);
+	return AudioEffect::setProcessing(state);
+}
+
+/* Audio queued for the sender thread beyond this duration is subject to `packets.policy`. */
+static const uint32_t queue_capacity_ms = 250;
+
+/* In the burst mode of offline rendering, the stream goes at this many times real time.
+ * Further behind than the catch up limit, the stream continues at the host's pace instead
+ * of catching up. */
+static const auto offline_catch_up_limit = std::chrono::milliseconds(100);
+static const uint32_t offline_burst_speed = 4;
+
+/* Longest the audio thread waits for the wire in one block when rendering offline, as long
+ * as the queue holds. A block longer than this goes out faster than its pace, which the
+ * queue absorbs until its policy applies. */
+static const auto offline_max_wait = std::chrono::milliseconds(queue_capacity_ms);
+
 static uint32_t param_to_u32(double value, uint32_t max)
 {
 	return std::clamp((uint32_t)(value * max + 0.5), 0u, max);
 }
 
+static uint8_t format_index(uint8_t format)
+{
+	for (uint8_t i = 0; i < PACKETIZER_N_FORMATS; i++) {
+		if (packetizer_formats[i] == format)
+			return i;
+	}
+	return 0;
+}
+
 tresult PLUGIN_API CVBANPluginProcessor::process(Vst::ProcessData &data)
 {
+	VBAN_TRACE2(process_entry, data.numSamples, data.processMode);
+
 	if (auto *paramChanges = data.inputParameterChanges) {
+		bool routing_changed = false;
 		int32_t n = paramChanges->getParameterCount();
 		for (int i = 0; i < n; i++) {
 			auto *paramQueue = paramChanges->getParameterData(i);
@@ -95,48 +226,291 @@ tresult PLUGIN_API CVBANPluginProcessor::process(Vst::ProcessData &data)
 			case paramid_port:
 				dest_port = param_to_u32(value, 65535);
 				break;
+			case paramid_fec_group:
+				fec_group = param_to_u32(value, VBAN_FEC_GROUP_MAX);
+				break;
+			case paramid_latency_target:
+				latency_target_ms = param_to_u32(value, VBAN_LATENCY_TARGET_MAX_MS);
+				break;
+			case paramid_txtime:
+				sock_opts.txtime = value >= 0.5;
+				break;
+			case paramid_dscp:
+				sock_opts.dscp = (uint8_t)param_to_u32(value, 63);
+				break;
+			case paramid_so_priority:
+				sock_opts.priority = (uint8_t)param_to_u32(value, 7);
+				break;
+			case paramid_sndbuf:
+				sock_opts.sndbuf_kb = (uint16_t)param_to_u32(value, VBAN_SNDBUF_MAX_KB);
+				break;
+			case paramid_transport:
+				transport = (vban_transport)param_to_u32(value, transport_count - 1);
+				break;
+			case paramid_group:
+				group_id = param_to_u32(value, VBAN_GROUP_MAX);
+				break;
+			case paramid_group_offset:
+				group_offset = param_to_u32(value, VBAN_GROUP_MAX_CHANNELS - 1);
+				break;
+			case paramid_output_mode:
+				output_mode.store((vban_output_mode)param_to_u32(value, output_mode_count - 1),
+						  std::memory_order_relaxed);
+				break;
+			case paramid_offline_mode:
+				offline_mode.store((vban_offline_mode)param_to_u32(value, offline_mode_count - 1),
+						   std::memory_order_relaxed);
+				break;
+			case paramid_capture:
+				capture_enabled = value >= 0.5;
+				break;
+			case paramid_overflow_policy:
+				packets.policy.store((audio_buffer_overflow_policy)param_to_u32(value, overflow_policy_count - 1),
+						     std::memory_order_relaxed);
+				break;
+			case paramid_format:
+				vban_format = packetizer_format_steps[param_to_u32(value, PACKETIZER_N_FORMATS - 1)];
+				break;
+			case paramid_vban_channels:
+				routing.n_out = 1 + param_to_u32(value, VBAN_ROUTE_MAX_OUT - 1);
+				routing_changed = true;
+				break;
+			default:
+				if (auto id = paramQueue->getParameterId() - paramid_route_gain;
+				    id < VBAN_ROUTE_MAX_OUT * VBAN_ROUTE_MAX_IN) {
+					routing.gain[id / VBAN_ROUTE_MAX_IN][id % VBAN_ROUTE_MAX_IN] = (float)value;
+					routing_changed = true;
+				}
+				break;
 			}
 		}
+
+		if (routing_changed) {
+			std::unique_lock lk(props_mutex);
+			capture_mask.store(routing.input_mask(VBAN_ROUTE_MAX_IN), std::memory_order_relaxed);
+		}
 	}
 
-	if (data.numInputs == 0 || data.numOutputs == 0)
+	if (data.numInputs == 0 || data.numOutputs == 0) {
+		VBAN_TRACE2(process_exit, data.numSamples, 0);
 		return kResultOk;
+	}
 
 	int32_t numChannels = data.inputs[0].numChannels;
 	uint32_t sampleFramesSize = Steinberg::Vst::getSampleFramesSizeInBytes(processSetup, data.numSamples);
 	void **in = getChannelBuffersPointer(processSetup, data.inputs[0]);
 	void **out = getChannelBuffersPointer(processSetup, data.outputs[0]);
 
-	if (data.inputs[0].silenceFlags == Steinberg::Vst::getChannelMask(data.inputs[0].numChannels)) {
-		/* all channels are silent */
-		data.outputs[0].silenceFlags = data.inputs[0].silenceFlags;
+	audio_timestamp timestamp = {};
+	if (data.processContext) {
+		const Steinberg::Vst::ProcessContext &pc = *data.processContext;
+		/* The system time does not follow the samples when rendering offline. */
+		if ((pc.state & Steinberg::Vst::ProcessContext::kSystemTimeValid) && data.processMode != Vst::kOffline) {
+			timestamp.system_time = pc.systemTime;
+			timestamp.system_time_valid = true;
+		}
+		if (pc.state & Steinberg::Vst::ProcessContext::kContTimeValid) {
+			timestamp.cont_time = pc.continousTimeSamples;
+			timestamp.cont_time_valid = true;
+		}
+	}
 
+	/* The sender starts over when the host switches between real time and offline. */
+	if ((data.processMode == Vst::kOffline) != offline) {
+		offline = data.processMode == Vst::kOffline;
+		offline_clock = std::chrono::steady_clock::now();
+		packets.resync();
+	}
+	const vban_output_mode output_mode_local = output_mode.load(std::memory_order_relaxed);
+	const vban_offline_mode offline_mode_local = offline_mode.load(std::memory_order_relaxed);
+	const bool suspended = offline && offline_mode_local == offline_suspend;
+	packets.speed = offline && offline_mode_local == offline_burst ? offline_burst_speed : 1;
+	packets.realtime.store(!offline, std::memory_order_relaxed);
+
+	const bool all_silent = data.inputs[0].silenceFlags == Steinberg::Vst::getChannelMask(numChannels);
+	const bool pass_through = output_mode_local == output_pass_through && !all_silent;
+
+	/* The input is captured before the output is written since they may alias. Silent blocks
+	 * are queued without samples, which the sender thread reads as silence. The pass-through
+	 * is written in the same pass as the capture. */
+	uint32_t mask = all_silent ? 0 : capture_mask.load(std::memory_order_relaxed);
+	bool queued = !suspended &&
+		      packets.add_float(in, numChannels, mask, data.numSamples, timestamp, pass_through ? out : nullptr);
+
+	/* The meters show every host input channel. Those not measured by the capture above, not
+	 * routed or in a block not queued, are read once more unless flagged silent, about 60 ns
+	 * per 256 samples. */
+	uint64_t n_bytes = 0;
+	for (int32_t i = 0; i < numChannels; i++) {
+		if ((queued && (mask & (1u << i))) || (data.inputs[0].silenceFlags & (1ULL << i)))
+			continue;
+		packets.levels.measure(i, static_cast<const float *>(in[i]), data.numSamples);
+		n_bytes += sampleFramesSize;
+	}
+	packets.levels.n_frames += data.numSamples;
+
+	for (int32_t i = 0; i < numChannels; i++) {
+		const bool captured = queued && (mask & (1u << i));
+		const bool copy = pass_through && in[i] != out[i];
+		if (captured)
+			n_bytes += (copy ? 3 : 2) * sampleFramesSize;
+		else if (copy) {
+			memcpy(out[i], in[i], sampleFramesSize);
+			n_bytes += 2 * sampleFramesSize;
+		}
+	}
+
+	switch (output_mode_local) {
+	case output_pass_through:
+		data.outputs[0].silenceFlags = data.inputs[0].silenceFlags;
+		if (all_silent) {
+			for (int32_t i = 0; i < numChannels; i++)
+				memset(out[i], 0, sampleFramesSize);
+			n_bytes += numChannels * sampleFramesSize;
+		}
+		break;
+	case output_mute:
+		data.outputs[0].silenceFlags = Steinberg::Vst::getChannelMask(numChannels);
 		for (int32_t i = 0; i < numChannels; i++)
 			memset(out[i], 0, sampleFramesSize);
-	} else {
-		data.outputs[0].silenceFlags = 0;
-
+		n_bytes += numChannels * sampleFramesSize;
+		break;
+	case output_bypass:
+	default:
+		/* Buffers processed in place carry the input, the others are not written. */
+		data.outputs[0].silenceFlags = Steinberg::Vst::getChannelMask(numChannels);
 		for (int32_t i = 0; i < numChannels; i++) {
-			if (in[i] != out[i])
-				memcpy(out[i], in[i], sampleFramesSize);
+			if (in[i] == out[i] && !(data.inputs[0].silenceFlags & (1ULL << i)))
+				data.outputs[0].silenceFlags &= ~(1ULL << i);
 		}
+		break;
 	}
+	stats.n_process_bytes.fetch_add(n_bytes, std::memory_order_relaxed);
+
+	if (offline && !suspended)
+		throttle_offline(data.numSamples, packets.speed);
 
-	packets.add_float(out, numChannels, data.numSamples);
+	report_latency(data);
+	report_levels(data);
 
+	VBAN_TRACE2(process_exit, data.numSamples, queued);
 	return kResultOk;
 }
 
+/* Interval to send the latency and the levels to the controller. */
+static const uint32_t latency_report_interval_ms = 100;
+static const uint32_t levels_report_interval_ms = 50;
+
+void CVBANPluginProcessor::report_latency(Vst::ProcessData &data)
+{
+	latency_report_frames += data.numSamples;
+	if (!data.outputParameterChanges ||
+	    latency_report_frames < processSetup.sampleRate * latency_report_interval_ms / 1000)
+		return;
+	latency_report_frames = 0;
+
+	uint32_t frames = stats.latency_frames.load(std::memory_order_relaxed);
+	uint32_t ms = std::min((uint32_t)(frames * 1000 / processSetup.sampleRate + 0.5), (uint32_t)VBAN_LATENCY_MAX_MS);
+	if (ms == latency_reported_ms)
+		return;
+
+	int32 index;
+	if (auto *queue = data.outputParameterChanges->addParameterData(paramid_latency, index)) {
+		queue->addPoint(0, (double)ms / VBAN_LATENCY_MAX_MS, index);
+		latency_reported_ms = ms;
+	}
+}
+
+static double level_to_param(double level)
+{
+	if (level <= 0.0)
+		return 0.0;
+	double db = 20.0 * log10(level);
+	return std::clamp((db - VBAN_LEVEL_FLOOR_DB) / -VBAN_LEVEL_FLOOR_DB, 0.0, 1.0);
+}
+
+void CVBANPluginProcessor::report_levels(Vst::ProcessData &data)
+{
+	levels_report_frames += data.numSamples;
+	if (!data.outputParameterChanges ||
+	    levels_report_frames < processSetup.sampleRate * levels_report_interval_ms / 1000)
+		return;
+	levels_report_frames = 0;
+
+	/* Input meters, before the routing matrix, see `audio_levels`. */
+	static_assert(VBAN_ROUTE_MAX_IN <= AUDIO_LEVELS_MAX_CHANNELS, "every host input channel is metered");
+	audio_levels &levels = packets.levels;
+	for (uint32_t i = 0; i < VBAN_ROUTE_MAX_IN; i++) {
+		double rms = levels.n_frames ? sqrt(levels.sum_sq[i] / levels.n_frames) : 0.0;
+		const float values[2] = {(float)level_to_param(levels.peak[i]), (float)level_to_param(rms)};
+		const Vst::ParamID ids[2] = {paramid_level_peak + i, paramid_level_rms + i};
+
+		for (int k = 0; k < 2; k++) {
+			if (values[k] == levels_reported[k][i])
+				continue;
+			int32 index;
+			if (auto *queue = data.outputParameterChanges->addParameterData(ids[k], index)) {
+				queue->addPoint(0, values[k], index);
+				levels_reported[k][i] = values[k];
+			}
+		}
+	}
+	levels.reset();
+}
+
+/* Holds `process()` until the audio processed offline is ahead of the wire by one block, the
+ * depth the sender keeps buffered, so that it neither drops nor piles up audio. */
+void CVBANPluginProcessor::throttle_offline(uint32_t n_samples, uint32_t speed)
+{
+	auto now = std::chrono::steady_clock::now();
+	if (offline_clock < now - offline_catch_up_limit)
+		offline_clock = now;
+
+	auto block = std::chrono::nanoseconds((int64_t)(n_samples * 1e9 / processSetup.sampleRate / speed));
+	offline_clock += block;
+	if (offline_clock - block > now + offline_max_wait)
+		offline_clock = now + offline_max_wait + block;
+	if (offline_clock - block > now)
+		std::this_thread::sleep_until(offline_clock - block);
+}
+
 tresult PLUGIN_API CVBANPluginProcessor::setupProcessing(Vst::ProcessSetup &newSetup)
 {
 	//--- called before any processing ----
 
+	if (cont && !has_error && newSetup.sampleRate == processSetup.sampleRate &&
+	    newSetup.maxSamplesPerBlock == processSetup.maxSamplesPerBlock &&
+	    newSetup.symbolicSampleSize == processSetup.symbolicSampleSize) {
+		/* Only the process mode has changed, which `process` follows without restarting the
+		 * sender thread. A thread that has stopped on an error is restarted below. */
+		return AudioEffect::setupProcessing(newSetup);
+	}
+
 	if (cont)
 		thread_stop();
 
+	/* The sender thread reads `processSetup` so it has to be updated first. */
+	tresult result = AudioEffect::setupProcessing(newSetup);
+
+	uint32_t block = (uint32_t)std::max(newSetup.maxSamplesPerBlock, 1);
+	packets.capacity = std::max(4u, (uint32_t)(newSetup.sampleRate * queue_capacity_ms / 1000 / block));
+
 	thread_start();
 
-	return AudioEffect::setupProcessing(newSetup);
+	return result;
+}
+
+tresult PLUGIN_API CVBANPluginProcessor::setBusArrangements(Vst::SpeakerArrangement *inputs, int32 numIns,
+							  Vst::SpeakerArrangement *outputs, int32 numOuts)
+{
+	if (numIns != 1 || numOuts != 1 || inputs[0] != outputs[0])
+		return kResultFalse;
+
+	int32 n_channels = Vst::SpeakerArr::getChannelCount(inputs[0]);
+	if (n_channels < 1 || n_channels > VBAN_ROUTE_MAX_IN)
+		return kResultFalse;
+
+	return AudioEffect::setBusArrangements(inputs, numIns, outputs, numOuts);
 }
 
 tresult PLUGIN_API CVBANPluginProcessor::canProcessSampleSize(int32 symbolicSampleSize)
@@ -168,6 +542,80 @@ tresult PLUGIN_API CVBANPluginProcessor::setState(IBStream *state)
 	std::unique_lock lk(props_mutex);
 	streamer.readInt32u(dest_addr);
 	streamer.readInt16u(dest_port);
+	if (version_minor >= 1) {
+		uint8_t fec_group_u8 = 0;
+		streamer.readInt8u(fec_group_u8);
+		fec_group = fec_group_u8;
+	}
+	if (version_minor >= 2) {
+		uint8_t n_out = 0;
+		if (streamer.readInt8u(n_out))
+			routing.n_out = std::clamp<uint32_t>(n_out, 1, VBAN_ROUTE_MAX_OUT);
+		for (uint32_t o = 0; o < VBAN_ROUTE_MAX_OUT; o++) {
+			for (uint32_t i = 0; i < VBAN_ROUTE_MAX_IN; i++)
+				streamer.readFloat(routing.gain[o][i]);
+		}
+	}
+	if (version_minor >= 3) {
+		uint8_t format = 0;
+		streamer.readInt8u(format);
+		if (format < PACKETIZER_N_FORMATS)
+			vban_format = packetizer_formats[format];
+	}
+	if (version_minor >= 4) {
+		uint8_t policy = 0;
+		streamer.readInt8u(policy);
+		if (policy < overflow_policy_count)
+			packets.policy.store((audio_buffer_overflow_policy)policy, std::memory_order_relaxed);
+	}
+	if (version_minor >= 5) {
+		uint16_t latency_target = 0;
+		streamer.readInt16u(latency_target);
+		latency_target_ms = std::min<uint32_t>(latency_target, VBAN_LATENCY_TARGET_MAX_MS);
+	}
+	if (version_minor >= 6) {
+		uint8_t txtime = 0, dscp = 0, priority = 0;
+		uint16_t sndbuf_kb = 0;
+		streamer.readInt8u(txtime);
+		streamer.readInt8u(dscp);
+		streamer.readInt8u(priority);
+		streamer.readInt16u(sndbuf_kb);
+		sock_opts.txtime = !!txtime;
+		sock_opts.dscp = std::min<uint8_t>(dscp, 63);
+		sock_opts.priority = std::min<uint8_t>(priority, 7);
+		sock_opts.sndbuf_kb = std::min<uint16_t>(sndbuf_kb, VBAN_SNDBUF_MAX_KB);
+	}
+	if (version_minor >= 7) {
+		uint8_t transport_u8 = 0;
+		streamer.readInt8u(transport_u8);
+		if (transport_u8 < transport_count)
+			transport = (vban_transport)transport_u8;
+	}
+	if (version_minor >= 8) {
+		uint8_t group = 0, offset = 0;
+		streamer.readInt8u(group);
+		streamer.readInt8u(offset);
+		group_id = std::min<uint32_t>(group, VBAN_GROUP_MAX);
+		group_offset = std::min<uint32_t>(offset, VBAN_GROUP_MAX_CHANNELS - 1);
+	}
+	if (version_minor >= 9) {
+		uint8_t mode = 0;
+		streamer.readInt8u(mode);
+		if (mode < output_mode_count)
+			output_mode.store((vban_output_mode)mode, std::memory_order_relaxed);
+	}
+	if (version_minor >= 10) {
+		uint8_t mode = 0;
+		streamer.readInt8u(mode);
+		if (mode < offline_mode_count)
+			offline_mode.store((vban_offline_mode)mode, std::memory_order_relaxed);
+	}
+	if (version_minor >= 11) {
+		uint8_t capture_u8 = 0;
+		streamer.readInt8u(capture_u8);
+		capture_enabled = !!capture_u8;
+	}
+	capture_mask.store(routing.input_mask(VBAN_ROUTE_MAX_IN), std::memory_order_relaxed);
 
 	return kResultOk;
 }
@@ -177,12 +625,31 @@ tresult PLUGIN_API CVBANPluginProcessor::getState(IBStream *state)
 	/* Called to save the configuration into `state` */
 	IBStreamer streamer(state, kLittleEndian);
 
-	uint32_t version = 0x01'00'0000;
+	uint32_t version = 0x01'0B'0000;
 	streamer.writeInt32u(version);
 
 	std::unique_lock lk(props_mutex);
 	streamer.writeInt32u(dest_addr);
 	streamer.writeInt16u(dest_port);
+	streamer.writeInt8u((uint8_t)fec_group);
+	streamer.writeInt8u((uint8_t)routing.n_out);
+	for (uint32_t o = 0; o < VBAN_ROUTE_MAX_OUT; o++) {
+		for (uint32_t i = 0; i < VBAN_ROUTE_MAX_IN; i++)
+			streamer.writeFloat(routing.gain[o][i]);
+	}
+	streamer.writeInt8u(format_index(vban_format));
+	streamer.writeInt8u((uint8_t)packets.policy.load(std::memory_order_relaxed));
+	streamer.writeInt16u((uint16_t)latency_target_ms);
+	streamer.writeInt8u(sock_opts.txtime ? 1 : 0);
+	streamer.writeInt8u(sock_opts.dscp);
+	streamer.writeInt8u(sock_opts.priority);
+	streamer.writeInt16u(sock_opts.sndbuf_kb);
+	streamer.writeInt8u((uint8_t)transport);
+	streamer.writeInt8u((uint8_t)group_id);
+	streamer.writeInt8u((uint8_t)group_offset);
+	streamer.writeInt8u((uint8_t)output_mode.load(std::memory_order_relaxed));
+	streamer.writeInt8u((uint8_t)offline_mode.load(std::memory_order_relaxed));
+	streamer.writeInt8u(capture_enabled ? 1 : 0);
 
 	return kResultOk;
 }
@@ -4,10 +4,21 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <pthread.h>
+#include "aggregation.h"
 #include "audio_buffer.h"
+#include "packet_capture.h"
+#include "paramids.h"
+#include "routing_matrix.h"
+#include "sender_stats.h"
+#include "shm_transport.h"
+#include "socket_options.h"
 #include "public.sdk/source/vst/vstaudioeffect.h"
 
+struct sockaddr_in;
+
 namespace NagaterNet {
 
 class CVBANPluginProcessor : public Steinberg::Vst::AudioEffect
@@ -34,9 +45,18 @@ public:
 	/** Switch the Plug-in on/off */
 	Steinberg::tresult PLUGIN_API setActive(Steinberg::TBool state) SMTG_OVERRIDE;
 
+	/** Called when the host starts or stops calling process */
+	Steinberg::tresult PLUGIN_API setProcessing(Steinberg::TBool state) SMTG_OVERRIDE;
+
 	/** Will be called before any process call */
 	Steinberg::tresult PLUGIN_API setupProcessing(Steinberg::Vst::ProcessSetup &newSetup) SMTG_OVERRIDE;
 
+	/** Accepts one input and one output bus with the same arrangement. */
+	Steinberg::tresult PLUGIN_API setBusArrangements(Steinberg::Vst::SpeakerArrangement *inputs,
+							 Steinberg::int32 numIns,
+							 Steinberg::Vst::SpeakerArrangement *outputs,
+							 Steinberg::int32 numOuts) SMTG_OVERRIDE;
+
 	/** Asks if a given sample size is supported see SymbolicSampleSizes. */
 	Steinberg::tresult PLUGIN_API canProcessSampleSize(Steinberg::int32 symbolicSampleSize) SMTG_OVERRIDE;
 
@@ -50,14 +70,46 @@ public:
 protected:
 	uint32_t dest_addr;
 	uint16_t dest_port;
+	uint32_t fec_group = 0;
+	struct routing_matrix routing;
+	uint8_t vban_format;
+	uint32_t latency_target_ms = 0; /* 0 selects the minimum safe latency */
+	struct socket_options sock_opts;
+	vban_transport transport = transport_udp;
+	uint32_t group_id = 0; /* aggregation group, 0 sends a stream of this instance */
+	uint32_t group_offset = 0;
+	/* Read once per block by `process`, also written by `setState` on another thread. */
+	std::atomic<vban_output_mode> output_mode{output_pass_through};
+	std::atomic<vban_offline_mode> offline_mode{offline_throttle};
+	bool capture_enabled = false;
+	bool offline = false; /* used only by `process` */
+	/* Time the audio processed offline is due on the wire, used only by `process` */
+	std::chrono::steady_clock::time_point offline_clock;
+	/* Input channels `process` captures, derived from `routing` under `props_mutex`, which
+	 * `setState` holds on another thread. */
+	std::atomic<uint32_t> capture_mask{0};
+	uint32_t latency_reported_ms = UINT32_MAX; /* used only by `process` */
+	uint32_t latency_report_frames = 0;        /* used only by `process` */
+	uint32_t levels_report_frames = 0;         /* used only by `process` */
+	float levels_reported[2][VBAN_ROUTE_MAX_IN]; /* peak and RMS, used only by `process` */
 	std::mutex props_mutex;
 
 	struct audio_buffer packets;
+	struct sender_stats stats;
+	struct packet_capture capture; /* used only by the sender thread, then `terminate` */
+	uint32_t capture_index;        /* of this instance, unique to the path of the capture */
+	struct shm_transport shm; /* used only by the sender thread */
+	struct aggregation_membership group_member; /* used only by the sender thread */
 	pthread_t thread;
 	volatile bool cont = false;
-	bool has_error;
+	volatile bool has_error = false; /* set by the sender thread when it stops on an error */
 
 private:
+	void capture_open(size_t ring_size);
+	void print_stats();
+	void report_latency(Steinberg::Vst::ProcessData &data);
+	void report_levels(Steinberg::Vst::ProcessData &data);
+	void throttle_offline(uint32_t n_samples, uint32_t speed);
 	void thread_start();
 	void thread_stop();
 	void thread_loop();
@@ -67,6 +119,10 @@ private:
 	bool thread_loop_init(struct loop_context &);
 	bool thread_loop_obtain_from_queue(struct loop_context &);
 	uint32_t thread_loop_send(struct loop_context &);
+	uint32_t thread_loop_publish(struct loop_context &);
+	void drain_txtime_errors(struct loop_context &);
+	void thread_loop_sendto(struct loop_context &, const uint8_t *data, uint32_t size,
+				const struct sockaddr_in &addr);
 };
 
 } // namespace NagaterNet
@@ -1,11 +1,78 @@
 #include <algorithm>
 #include <chrono>
+#include <deque>
 #include "vban.h"
+#include "vban_fec.h"
+#include "routing_matrix.h"
+#include "packetizer.h"
 #include "vban_processor.h"
 #include "socket.h"
+#include "socket_send.h"
+#include "trace.h"
 
 namespace NagaterNet {
 
+/* The backlog is cut back when it exceeds the prebuffer by this factor. */
+static const uint32_t backlog_resync_factor = 4;
+
+/* Host system time is trusted for pacing while it stays within this distance
+ * from the sample count, otherwise the stream restarts from the prebuffer. */
+static const int64_t timeline_tolerance_ns = 50'000'000;
+
+/* With SO_TXTIME, packets are handed to the kernel this much ahead of their launch time. */
+static const auto txtime_lead = std::chrono::microseconds(1000);
+static const auto txtime_min_lead = std::chrono::microseconds(200);
+
+/* The error queue of the packets dropped for missing their launch time is read after this many
+ * packets, not after each, and once more when the loop stops. */
+static const uint32_t txtime_drain_interval = 64;
+
+/* The shm ring holds about 340 ms at 48 kHz, readers are notified of it every 16 packets. */
+static const uint32_t shm_ring_slots = 64;
+static const uint32_t shm_serve_interval = 16;
+static const uint32_t shm_packet_frames = 256;
+static const uint32_t shm_packet_size_max = VBAN_HEADER_SIZE + shm_packet_frames * VBAN_ROUTE_MAX_OUT * 4;
+
+/* The minimum safe latency covers the peak block jitter by this factor. */
+static const double jitter_margin = 1.5;
+
+/* Lateness beyond this is taken as the host pausing, not as jitter. */
+static const double jitter_pause_us = 100e3;
+
+/* The packet capture holds this much of the stream at real time, with a parity packet for
+ * each packet, for its writer that takes the packets every 20 ms. */
+static const double capture_ring_seconds = 0.5;
+
+/* Concealment of an underrun fades the last frame out over this many frames, and
+ * the audio arriving after it fades back in over as many. */
+static const uint32_t conceal_fade_frames = 64;
+
+/* Lateness of the blocks from the audio thread relative to their sample position. */
+struct block_jitter
+{
+	bool has_base = false;
+	double base_us = 0.0; /* earliest arrival, rising slowly to follow the clock drift */
+	double peak_us = 0.0; /* decaying maximum of the lateness over the base */
+
+	void add(double offset_us)
+	{
+		if (!has_base || offset_us < base_us || offset_us - base_us > jitter_pause_us) {
+			base_us = offset_us;
+			has_base = true;
+		} else {
+			base_us += (offset_us - base_us) * 1e-3;
+		}
+
+		peak_us = std::max(offset_us - base_us, peak_us * 0.9995);
+	}
+
+	void reset()
+	{
+		has_base = false;
+		peak_us = 0.0;
+	}
+};
+
 void CVBANPluginProcessor::thread_start()
 {
 	cont = true;
@@ -34,15 +101,93 @@ struct loop_context
 
 	uint32_t vban_packet_frames;
 	uint32_t vban_channels;
-	uint32_t vban_sample_bytes;
-	uint32_t vban_frame_bytes; /* = vban_sample_bytes * vban_channels */
+	uint32_t n_out; /* channels mixed from the host input, the same as `vban_channels` unless aggregated */
+	uint8_t vban_format;
+
+	routing_matrix routing;
+	routing_mixer mixer;
+	std::vector<float> mixed_audio;
+	struct packetizer packetizer;
 
-	std::vector<uint8_t> interleaved_audio;
+	std::vector<float> interleaved_audio;
 	std::chrono::steady_clock::time_point next_send;
-	uint32_t last_packet_size;
+	uint32_t last_packet_frames = 0;
+	uint32_t latency_target_frames = 0; /* 0 selects the minimum safe latency */
+	uint32_t skipped_frames = 0; /* not yet reflected in nuFrame */
+	uint32_t concealed_frames = 0; /* sent in place of audio that has not arrived yet */
+	uint32_t conceal_run = 0;      /* frames concealed since the host audio was last sent */
+	std::vector<float> last_frame; /* of the host audio sent, where the concealment fades from */
+	double latency_frames = 0.0; /* averaged buffer depth when sending */
 	bool send_soon = false;
+	bool prebuffering = true;
+	bool realtime = true; /* see `audio_buffer::realtime`, underruns are concealed only in real time */
+	bool idle = false;    /* nothing can be sent until a parameter change restarts the loop */
+
+	/* Host timeline of the buffered frames. Frame positions count from the
+	 * start of the loop; `frames_out` is the first frame in `interleaved_audio`. */
+	struct time_anchor
+	{
+		uint64_t frame;
+		int64_t system_time;
+	};
+	std::deque<time_anchor> time_anchors;
+	double sample_rate;
+	uint32_t speed = 1;  /* of the stream relative to real time, see `audio_buffer::speed` */
+	double ns_per_frame; /* on the wire, shorter than a frame when faster than real time */
+	uint64_t frames_in = 0;
+	uint64_t frames_out = 0;
+	audio_timestamp expected_timestamp = {}; /* of the frame following the last packet */
+
+	/* Arrival of the blocks, including the dropped frames, since `jitter_epoch`. */
+	block_jitter jitter;
+	std::chrono::steady_clock::time_point jitter_epoch;
+	uint64_t arrived_frames = 0;
+
+	/* Maps the host system time to `next_send`, set when prebuffering completes. */
+	bool clock_anchored = false;
+	std::chrono::steady_clock::time_point clock_anchor;
+	int64_t clock_anchor_system_time;
+	uint32_t clock_anchor_buffer_frames; /* buffer depth the anchor was made for */
+
+	/* Returns the host system time of the frame, if known. */
+	bool system_time_at(uint64_t frame, int64_t &system_time)
+	{
+		while (time_anchors.size() >= 2 && time_anchors[1].frame <= frame)
+			time_anchors.pop_front();
+		if (time_anchors.empty())
+			return false;
+
+		const time_anchor &a = time_anchors.front();
+		system_time = a.system_time + (int64_t)(((double)frame - (double)a.frame) * ns_per_frame);
+		return true;
+	}
+
+	inline uint32_t buffered_frames() const
+	{
+		return (uint32_t)(interleaved_audio.size() / vban_channels);
+	}
 
 	socket_t vban_socket;
+	vban_transport transport;
+	uint16_t shm_port;
+
+	/* Aggregation into a group stream, see aggregation_group */
+	uint32_t group_id = 0;
+	uint32_t group_offset = 0;
+	bool group_leader = false;
+	bool has_group_position = false;
+	int64_t group_position;      /* of the next frame written by this instance */
+	bool group_armed = false;
+	int64_t group_read_position; /* of the next chunk read by the leader */
+	std::vector<float> group_chunk;
+	struct socket_options sock_opts;
+	bool txtime = false;
+	uint32_t txtime_sent = 0; /* packets since the error queue was read */
+	bool capture = false;
+	uint32_t capture_daddr = 0;             /* destination `capture_source` was looked up for */
+	struct sockaddr_in capture_source = {}; /* of `vban_socket`, recorded in the capture */
+	std::chrono::steady_clock::time_point launch_time; /* of the packet being sent, with `txtime` */
+	vban_fec_encoder fec;
 
 	loop_context()
 	{
@@ -73,35 +218,306 @@ bool CVBANPluginProcessor::thread_loop_init(struct loop_context &ctx)
 		return false;
 	}
 
-	ctx.vban_sample_bytes = 4; // 32-bit float
-	ctx.vban_channels = 2;
-	ctx.vban_frame_bytes = ctx.vban_sample_bytes * ctx.vban_channels;
-	ctx.vban_packet_frames = std::min(256u, VBAN_DATA_MAX_SIZE / ctx.vban_frame_bytes);
+	uint32_t latency_target;
+	{
+		std::unique_lock lk(props_mutex);
+		ctx.routing = routing;
+		ctx.vban_format = vban_format;
+		latency_target = latency_target_ms;
+		ctx.sock_opts = sock_opts;
+		ctx.transport = transport;
+		ctx.shm_port = dest_port;
+		ctx.group_id = group_id;
+		ctx.group_offset = group_offset;
+		ctx.capture = capture_enabled;
+	}
+	ctx.mixer.reset();
+	ctx.txtime = socket_options_apply(ctx.vban_socket, ctx.sock_opts) && ctx.sock_opts.txtime;
+	ctx.sample_rate = processSetup.sampleRate;
+	ctx.latency_target_frames = (uint32_t)(latency_target * ctx.sample_rate / 1000);
+
+	ctx.n_out = ctx.routing.n_out;
+	ctx.vban_channels = ctx.n_out;
+
+	/* Such as when the channels do not fit in the group or it runs at another sample rate. The
+	 * error is reported, the loop waits for a change of the group, offset or channels. */
+	ctx.idle = !group_member.update(ctx.group_id, ctx.group_offset, ctx.n_out, ctx.sample_rate);
+	if (aggregation_group *group = group_member.group()) {
+		/* Only the leader sends, the stream has the channels of every member. */
+		ctx.group_leader = group_member.is_leader();
+		if (ctx.group_leader)
+			ctx.vban_channels = std::max(1u, group->n_channels.load(std::memory_order_acquire));
+	}
+
+	if (!ctx.packetizer.select(ctx.vban_channels, ctx.vban_format)) {
+		fprintf(stderr, "Error: VBAN cannot send the requested format %d\n", ctx.vban_format);
+		return false;
+	}
+
+	ctx.vban_packet_frames = std::min(256u, ctx.packetizer.max_frames(ctx.vban_channels, VBAN_DATA_MAX_SIZE));
+
+	if (ctx.transport == transport_shm) {
+		/* Not limited by the UDP payload size */
+		ctx.vban_packet_frames = std::min(
+			shm_packet_frames,
+			ctx.packetizer.max_frames(ctx.vban_channels, shm_packet_size_max - VBAN_HEADER_SIZE));
+		/* Such as when another instance serves the port. The error is reported, the loop waits
+		 * for another port or transport. */
+		if (!shm.open(ctx.shm_port, shm_ring_slots, shm_packet_size_max))
+			ctx.idle = true;
+	} else if (shm.is_open()) {
+		shm.close();
+	}
 
-	ctx.vban_header.format_nbc = ctx.vban_channels - 1; // Stereo only // TODO: Allow other settings
-	ctx.vban_header.format_bit = VBAN_BITFMT_32_FLOAT;
+	ctx.vban_header.format_nbc = ctx.vban_channels - 1;
+	ctx.vban_header.format_bit = ctx.vban_format;
 	strncpy(ctx.vban_header.streamname, "VST3", VBAN_STREAM_NAME_SIZE); // TODO: Set name
 
 	ctx.vban_header.format_nbs = (uint8_t)(ctx.vban_packet_frames - 1);
+	ctx.last_frame.assign(ctx.vban_channels, 0.0f);
+	ctx.mixed_audio.reserve((size_t)ctx.n_out * std::max<int32_t>(processSetup.maxSamplesPerBlock, 1));
+
+	if (ctx.capture) {
+		const uint32_t packet_bytes =
+			VBAN_HEADER_SIZE + ctx.packetizer.payload_bytes(ctx.vban_channels, ctx.vban_packet_frames);
+		const double packets = capture_ring_seconds * ctx.sample_rate / ctx.vban_packet_frames * 2;
+		capture_open((size_t)(packets * packet_capture::ring_bytes(packet_bytes)));
+	} else {
+		capture.close();
+	}
 
+	ctx.ns_per_frame = 1e9 / ctx.sample_rate;
 	ctx.next_send = std::chrono::steady_clock::now();
+	ctx.jitter_epoch = ctx.next_send;
 	ctx.send_soon = true;
 
 	return true;
 }
 
-static void copy_packet_to_buffer(struct loop_context &ctx, std::vector<uint8_t> &dst, struct audio_packet &pkt)
+/* Applies the routing matrix and returns `ctx.n_out` planes, for the aggregation group that
+ * takes planar audio. `ctx.mixed_audio` is reserved for the largest block in the init. */
+static void mix_packet(struct loop_context &ctx, struct audio_packet &pkt, const float *planes[VBAN_ROUTE_MAX_OUT])
 {
 	const uint32_t n_samples = pkt.n_samples;
+	const uint32_t n_in = std::min<uint32_t>(pkt.n_channels, VBAN_ROUTE_MAX_IN);
 
-	dst.reserve(dst.size() + n_samples * ctx.vban_frame_bytes);
+	const float *in[VBAN_ROUTE_MAX_IN] = {};
+	for (uint32_t ch = 0; ch < n_in; ch++)
+		in[ch] = pkt.channel(ch);
 
-	for (uint32_t i = 0; i < n_samples; i++) {
-		for (uint32_t ch = 0; ch < ctx.vban_channels; ch++) {
-			uint8_t *begin = pkt.data.data() + (i + ch * n_samples) * ctx.vban_sample_bytes;
-			dst.insert(dst.end(), begin, begin + ctx.vban_sample_bytes);
-		}
+	float *mixed[VBAN_ROUTE_MAX_OUT];
+	ctx.mixed_audio.resize(ctx.n_out * n_samples);
+	for (uint32_t ch = 0; ch < ctx.n_out; ch++)
+		mixed[ch] = ctx.mixed_audio.data() + ch * n_samples;
+
+	bool is_mixed = ctx.mixer.process(ctx.routing, in, n_in, mixed, n_samples);
+	for (uint32_t ch = 0; ch < ctx.n_out; ch++)
+		planes[ch] = is_mixed ? mixed[ch] : ch < VBAN_ROUTE_MAX_IN ? in[ch] : nullptr;
+}
+
+static void copy_packet_to_buffer(struct loop_context &ctx, std::vector<float> &dst, struct audio_packet &pkt)
+{
+	const uint32_t n_samples = pkt.n_samples;
+	const uint32_t n_in = std::min<uint32_t>(pkt.n_channels, VBAN_ROUTE_MAX_IN);
+
+	const float *in[VBAN_ROUTE_MAX_IN] = {};
+	for (uint32_t ch = 0; ch < n_in; ch++)
+		in[ch] = pkt.channel(ch);
+
+	/* The matrix is applied as the frames are interleaved, unless the inputs pass through. */
+	const size_t offset = dst.size();
+	dst.resize(offset + n_samples * ctx.vban_channels);
+	if (!ctx.mixer.process_interleaved(ctx.routing, in, n_in, dst.data() + offset, n_samples))
+		ctx.packetizer.interleave(in, ctx.vban_channels, n_samples, dst.data() + offset);
+
+	if (pkt.timestamp.system_time_valid && n_samples)
+		ctx.time_anchors.push_back({ctx.frames_in, pkt.timestamp.system_time});
+	ctx.frames_in += n_samples;
+}
+
+/* Advances nuFrame over frames that will never be sent so that receivers see the gap. */
+static void skip_frames(struct loop_context &ctx, struct sender_stats &stats, uint32_t n_frames)
+{
+	stats.n_skipped_frames.fetch_add(n_frames, std::memory_order_relaxed);
+	ctx.skipped_frames += n_frames;
+	ctx.vban_header.nuFrame += ctx.skipped_frames / ctx.vban_packet_frames;
+	ctx.skipped_frames %= ctx.vban_packet_frames;
+}
+
+static void drop_frames(struct loop_context &ctx, uint32_t n_frames)
+{
+	ctx.interleaved_audio.erase(ctx.interleaved_audio.begin(),
+				    ctx.interleaved_audio.begin() + n_frames * ctx.vban_channels);
+	ctx.frames_out += n_frames;
+}
+
+static void discard_backlog(struct loop_context &ctx, struct sender_stats &stats, uint32_t n_frames)
+{
+	n_frames = std::min(n_frames, ctx.buffered_frames());
+	drop_frames(ctx, n_frames);
+	skip_frames(ctx, stats, n_frames);
+}
+
+/* Appends frames fading the last frame out to silence, continuing the fade of the run. */
+static void append_concealment(struct loop_context &ctx, struct sender_stats &stats, uint32_t n_frames)
+{
+	const size_t offset = ctx.interleaved_audio.size();
+	ctx.interleaved_audio.resize(offset + n_frames * ctx.vban_channels);
+	float *dst = ctx.interleaved_audio.data() + offset;
+	for (uint32_t i = 0; i < n_frames; i++) {
+		uint32_t n_faded = ctx.conceal_run + i + 1;
+		float gain = n_faded < conceal_fade_frames ? 1.0f - (float)n_faded / conceal_fade_frames : 0.0f;
+		for (uint32_t ch = 0; ch < ctx.vban_channels; ch++)
+			*dst++ = ctx.last_frame[ch] * gain;
 	}
+
+	ctx.frames_in += n_frames;
+	ctx.conceal_run += n_frames;
+	stats.n_concealed_frames.fetch_add(n_frames, std::memory_order_relaxed);
+}
+
+/* Pads the buffer to a packet when the host has not delivered the audio of the packet due,
+ * so that the wire keeps its pace and receivers their lock. Once the host has been late
+ * for longer than a pause, the stream waits for the audio and starts over from the
+ * prebuffer instead. */
+static void conceal_underrun(struct loop_context &ctx, struct sender_stats &stats)
+{
+	const uint32_t n_buffered = ctx.buffered_frames();
+	const uint32_t n_frames = ctx.vban_packet_frames - n_buffered;
+
+	if ((ctx.concealed_frames + n_frames) * ctx.ns_per_frame > jitter_pause_us * 1e3) {
+		stats.n_underrun_pauses.fetch_add(1, std::memory_order_relaxed);
+		ctx.concealed_frames = 0;
+		ctx.conceal_run = 0;
+		ctx.prebuffering = true;
+		return;
+	}
+
+	if (!ctx.conceal_run) {
+		stats.n_underruns.fetch_add(1, std::memory_order_relaxed);
+		if (n_buffered)
+			std::copy(ctx.interleaved_audio.end() - ctx.vban_channels, ctx.interleaved_audio.end(),
+				  ctx.last_frame.begin());
+	}
+
+	VBAN_TRACE2(conceal, ctx.vban_header.nuFrame, n_frames);
+	append_concealment(ctx, stats, n_frames);
+	ctx.concealed_frames += n_frames;
+}
+
+/* Drops the audio arriving after the concealment that was sent in its place, so that the
+ * wire latency stays as it was, and fades the rest in from the concealment at frame
+ * `splice` of the buffer. The buffer was emptied by the concealment, so the late frames
+ * are at its front. */
+static void splice_late_audio(struct loop_context &ctx, struct sender_stats &stats, uint32_t splice)
+{
+	if (uint32_t n_late = std::min(ctx.concealed_frames, ctx.buffered_frames())) {
+		drop_frames(ctx, n_late);
+		ctx.concealed_frames -= n_late;
+		stats.n_late_frames.fetch_add(n_late, std::memory_order_relaxed);
+	}
+
+	if (ctx.concealed_frames || ctx.buffered_frames() <= splice)
+		return;
+
+	const uint32_t n_fade = std::min(conceal_fade_frames, ctx.buffered_frames() - splice);
+	float *dst = ctx.interleaved_audio.data() + splice * ctx.vban_channels;
+	for (uint32_t i = 0; i < n_fade; i++) {
+		float gain = (float)i / n_fade;
+		for (uint32_t ch = 0; ch < ctx.vban_channels; ch++)
+			*dst++ *= gain;
+	}
+	ctx.conceal_run = 0;
+}
+
+/* Writes the packet into the aggregation group. The leader also reads the chunks that the
+ * members had the time to write, which then go through the same path as its own audio. */
+static void write_packet_to_group(struct loop_context &ctx, struct sender_stats &stats, aggregation_group &group,
+				  struct audio_packet &pkt)
+{
+	const uint32_t n_samples = pkt.n_samples;
+
+	/* Members on the same host timeline are sample-aligned. Others continue from the
+	 * position written last by the leader. */
+	if (pkt.timestamp.cont_time_valid) {
+		ctx.group_position = pkt.timestamp.cont_time;
+		ctx.has_group_position = true;
+	} else if (!ctx.has_group_position) {
+		ctx.group_position = group.head.load(std::memory_order_acquire);
+		ctx.has_group_position = true;
+	} else {
+		ctx.group_position += pkt.n_dropped_before;
+	}
+
+	const float *planes[VBAN_ROUTE_MAX_OUT];
+	mix_packet(ctx, pkt, planes);
+	if (uint32_t n_late = group.write(ctx.group_position, planes, ctx.group_offset, ctx.n_out, n_samples))
+		stats.n_group_dropped_frames.fetch_add(n_late, std::memory_order_relaxed);
+	ctx.group_position += n_samples;
+
+	if (!ctx.group_leader)
+		return;
+
+	group.head.store(ctx.group_position, std::memory_order_release);
+
+	/* A chunk is read once the leader is two blocks past it. */
+	const int64_t margin = 2 * (int64_t)ctx.last_packet_frames;
+	const int64_t end = ctx.group_position - margin;
+
+	if (!ctx.group_armed || end - ctx.group_read_position > VBAN_GROUP_CHUNK_FRAMES * VBAN_GROUP_N_CHUNKS ||
+	    end < ctx.group_read_position - VBAN_GROUP_CHUNK_FRAMES * VBAN_GROUP_N_CHUNKS) {
+		/* Start over from the current position if the leader has jumped. */
+		if (ctx.group_armed)
+			stats.n_group_resyncs.fetch_add(1, std::memory_order_relaxed);
+		ctx.group_read_position = end - ((end % VBAN_GROUP_CHUNK_FRAMES) + VBAN_GROUP_CHUNK_FRAMES) % VBAN_GROUP_CHUNK_FRAMES;
+		group.arm(ctx.group_read_position);
+		ctx.group_armed = true;
+	}
+
+	const uint64_t expected_mask = group.channel_mask.load(std::memory_order_relaxed);
+	ctx.group_chunk.resize(VBAN_GROUP_CHUNK_FRAMES * ctx.vban_channels);
+	while (ctx.group_read_position + VBAN_GROUP_CHUNK_FRAMES <= end) {
+		uint64_t mask = group.read(ctx.group_read_position, ctx.vban_channels, ctx.group_chunk.data());
+		if ((mask & expected_mask) != expected_mask)
+			stats.n_group_partial_chunks.fetch_add(1, std::memory_order_relaxed);
+		ctx.group_read_position += VBAN_GROUP_CHUNK_FRAMES;
+
+		ctx.interleaved_audio.insert(ctx.interleaved_audio.end(), ctx.group_chunk.begin(), ctx.group_chunk.end());
+		ctx.frames_in += VBAN_GROUP_CHUNK_FRAMES;
+	}
+}
+
+/* Returns true if the packet does not continue the host timeline of the previous one,
+ * such as when the host stopped processing for a while or restarted its clock. Frames
+ * the host skipped during an underrun are not a discontinuity as long as they could
+ * be concealed, they are counted into `n_missing` with the frames dropped from the queue. */
+static bool is_discontinuous(struct loop_context &ctx, const struct audio_packet &pkt, uint32_t &n_missing)
+{
+	const audio_timestamp &expected = ctx.expected_timestamp;
+	const audio_timestamp &ts = pkt.timestamp;
+	uint32_t n_frames = pkt.n_dropped_before;
+	bool ret = false;
+
+	if (expected.cont_time_valid && ts.cont_time_valid && ts.cont_time != expected.cont_time + n_frames) {
+		int64_t gap = ts.cont_time - expected.cont_time;
+		if (ctx.conceal_run && gap > n_frames && gap * ctx.ns_per_frame <= jitter_pause_us * 1e3)
+			n_frames = (uint32_t)gap;
+		else
+			ret = true;
+	}
+	n_missing = n_frames;
+
+	if (expected.system_time_valid && ts.system_time_valid) {
+		int64_t diff = ts.system_time - expected.system_time - (int64_t)(n_frames * ctx.ns_per_frame);
+		if (diff > timeline_tolerance_ns || diff < -timeline_tolerance_ns)
+			ret = true;
+	}
+
+	ctx.expected_timestamp = ts;
+	ctx.expected_timestamp.cont_time += pkt.n_samples;
+	ctx.expected_timestamp.system_time += (int64_t)(pkt.n_samples * ctx.ns_per_frame);
+
+	return ret;
 }
 
 bool CVBANPluginProcessor::thread_loop_obtain_from_queue(struct loop_context &ctx)
@@ -116,23 +532,107 @@ bool CVBANPluginProcessor::thread_loop_obtain_from_queue(struct loop_context &ct
 		if (!cont_local)
 			return false;
 
+		/* With SO_TXTIME, the packet is handed to the kernel `txtime_lead` before it leaves. */
+		const auto deadline = ctx.txtime ? ctx.next_send - txtime_lead : ctx.next_send;
+		VBAN_TRACE2(wait, ctx.send_soon, ctx.send_soon ? 0 : deadline.time_since_epoch().count());
 		if (ctx.send_soon)
 			packets.cond.wait_for(q1_lock, std::chrono::milliseconds(2));
 		else
-			packets.cond.wait_until(q1_lock, ctx.next_send);
-
-		while (packets.q1.size() && ((cont_local = cont))) {
-			struct audio_packet pkt;
-			pkt.swap(packets.q1.front());
-			packets.q1.pop();
+			packets.cond.wait_until(q1_lock, deadline);
+		VBAN_TRACE1(wake, packets.q1.size());
+		ctx.realtime = packets.realtime.load(std::memory_order_relaxed);
 
+		struct audio_packet pkt;
+		while ((cont_local = cont) && packets.pop(pkt)) {
 			q1_lock.unlock();
 
-			if (ctx.vban_header.format_nbc + 1 != pkt.n_channels)
+			uint8_t format;
+			uint32_t latency_target;
+			struct socket_options opts;
+			vban_transport transport_local;
+			uint32_t group_id_local, group_offset_local;
+			uint16_t port_local;
+			bool capture_local;
+			{
+				std::unique_lock lk(props_mutex);
+				ctx.routing = routing;
+				format = vban_format;
+				latency_target = latency_target_ms;
+				opts = sock_opts;
+				transport_local = transport;
+				group_id_local = group_id;
+				group_offset_local = group_offset;
+				port_local = dest_port;
+				capture_local = capture_enabled;
+			}
+			ctx.latency_target_frames = (uint32_t)(latency_target * ctx.sample_rate / 1000);
+
+			/* Restart the loop to apply the new number of channels, format, socket options, transport, or
+			 * capture. An idle loop also restarts on another port. */
+			if (ctx.routing.n_out != ctx.n_out || format != ctx.vban_format || opts != ctx.sock_opts ||
+			    transport_local != ctx.transport || capture_local != ctx.capture ||
+			    (ctx.idle && port_local != ctx.shm_port))
 				return false;
 
-			ctx.last_packet_size = pkt.data.size();
-			copy_packet_to_buffer(ctx, ctx.interleaved_audio, pkt);
+			/* Also when joining another group, or when the leader or the channels of the group change. */
+			aggregation_group *group = group_member.group();
+			if (group_id_local != ctx.group_id || group_offset_local != ctx.group_offset ||
+			    (group && group_member.is_leader() != ctx.group_leader) ||
+			    (group && ctx.group_leader &&
+			     group->n_channels.load(std::memory_order_acquire) != ctx.vban_channels))
+				return false;
+
+			uint32_t n_missing;
+			bool discontinuous = is_discontinuous(ctx, pkt, n_missing);
+			if (discontinuous)
+				stats.n_discontinuities.fetch_add(1, std::memory_order_relaxed);
+
+			/* Offline rendering has changed the pace, start over at the new one. */
+			bool speed_changed = pkt.speed != ctx.speed;
+			if (speed_changed) {
+				ctx.speed = pkt.speed;
+				ctx.ns_per_frame = 1e9 / ctx.sample_rate / ctx.speed;
+				ctx.jitter_epoch = std::chrono::steady_clock::now();
+				ctx.arrived_frames = 0;
+			}
+
+			if (pkt.resync || discontinuous || speed_changed) {
+				discard_backlog(ctx, stats, ctx.buffered_frames());
+				ctx.time_anchors.clear();
+				ctx.jitter.reset();
+				ctx.has_group_position = false;
+				ctx.prebuffering = true;
+				ctx.concealed_frames = 0;
+				ctx.conceal_run = 0;
+			}
+			if (n_missing) {
+				/* The frames never sent are skipped, unless concealment was sent in their
+				 * place. During an underrun, the frames not due yet are concealed too so
+				 * that the audio following them keeps its place on the wire. */
+				uint32_t n_concealed = std::min(n_missing, ctx.concealed_frames);
+				ctx.concealed_frames -= n_concealed;
+				if (ctx.conceal_run)
+					append_concealment(ctx, stats, n_missing - n_concealed);
+				else if (n_missing > n_concealed)
+					skip_frames(ctx, stats, n_missing - n_concealed);
+			}
+
+			/* The lateness of a block behind its concealment is a stall, not jitter. Taking
+			 * it into the target would move the wire by half as much again. */
+			ctx.arrived_frames += n_missing + pkt.n_samples;
+			std::chrono::duration<double, std::micro> arrival = std::chrono::steady_clock::now() - ctx.jitter_epoch;
+			if (!ctx.concealed_frames)
+				ctx.jitter.add(arrival.count() - ctx.arrived_frames * ctx.ns_per_frame * 1e-3);
+
+			ctx.last_packet_frames = pkt.n_samples;
+			const uint32_t n_buffered = ctx.buffered_frames();
+			VBAN_TRACE4(copy_packet, &packets, pkt.sequence, pkt.n_samples, n_buffered);
+			if (group)
+				write_packet_to_group(ctx, stats, *group, pkt);
+			else
+				copy_packet_to_buffer(ctx, ctx.interleaved_audio, pkt);
+			if (ctx.conceal_run)
+				splice_late_audio(ctx, stats, n_buffered);
 
 			received = true;
 
@@ -151,36 +651,120 @@ bool CVBANPluginProcessor::thread_loop_obtain_from_queue(struct loop_context &ct
 	return cont_local;
 }
 
+void CVBANPluginProcessor::drain_txtime_errors(struct loop_context &ctx)
+{
+	ctx.txtime_sent = 0;
+	if (uint32_t n = socket_drain_txtime_errors(ctx.vban_socket))
+		stats.n_txtime_dropped.fetch_add(n, std::memory_order_relaxed);
+}
+
+void CVBANPluginProcessor::thread_loop_sendto(struct loop_context &ctx, const uint8_t *data, uint32_t size,
+					      const struct sockaddr_in &addr)
+{
+	int ret;
+	if (ctx.txtime) {
+		ret = socket_sendto_txtime(ctx.vban_socket, data, size, (const struct sockaddr *)&addr,
+					   (socklen_t)sizeof(addr), socket_txtime_from_steady(ctx.launch_time));
+		if (++ctx.txtime_sent >= txtime_drain_interval)
+			drain_txtime_errors(ctx);
+	} else {
+		ret = sendto(ctx.vban_socket, data, size, 0, (const struct sockaddr *)&addr, (socklen_t)sizeof(addr));
+	}
+	if (ret != (int)size)
+		fprintf(stderr, "Error: Failed to send VBAN packet. errno=%d\n", errno);
+
+	if (capture.is_open()) {
+		/* The source port is bound by the first send. */
+		if (addr.sin_addr.s_addr != ctx.capture_daddr) {
+			ctx.capture_daddr = addr.sin_addr.s_addr;
+			socket_source_address(ctx.vban_socket, addr, ctx.capture_source);
+		}
+		capture.push(data, size, ctx.capture_source.sin_addr.s_addr, ctx.capture_source.sin_port,
+			     addr.sin_addr.s_addr, addr.sin_port);
+	}
+}
+
 uint32_t CVBANPluginProcessor::thread_loop_send(struct loop_context &ctx)
 {
-	uint32_t payload_bytes = ctx.vban_packet_frames * ctx.vban_frame_bytes;
+	uint32_t payload_samples = ctx.vban_packet_frames * ctx.vban_channels;
 
-	if (ctx.interleaved_audio.size() < payload_bytes)
+	if (ctx.interleaved_audio.size() < payload_samples)
 		return 0;
 
-	memcpy(ctx.vban_payload(), ctx.interleaved_audio.data(), payload_bytes);
-	ctx.interleaved_audio.erase(ctx.interleaved_audio.begin(), ctx.interleaved_audio.begin() + payload_bytes);
+	if (ctx.transport == transport_shm)
+		return thread_loop_publish(ctx);
+
+	uint32_t payload_bytes = ctx.packetizer.encode(ctx.interleaved_audio.data(), ctx.vban_channels,
+						       ctx.vban_packet_frames, ctx.vban_format, ctx.vban_payload());
+	ctx.interleaved_audio.erase(ctx.interleaved_audio.begin(), ctx.interleaved_audio.begin() + payload_samples);
+	ctx.frames_out += ctx.vban_packet_frames;
 
 	struct sockaddr_in addr;
 	addr.sin_family = AF_INET;
+	uint32_t fec_group_size;
 	{
 		std::unique_lock lk(props_mutex);
 		addr.sin_addr.s_addr = htonl(dest_addr);
 		addr.sin_port = htons(dest_port);
+		fec_group_size = fec_group;
 	}
 
-	if (addr.sin_addr.s_addr) {
-		int ret = sendto(ctx.vban_socket, ctx.vban_packet, VBAN_HEADER_SIZE + payload_bytes, 0,
-				 (struct sockaddr *)&addr, (socklen_t)sizeof(addr));
-		if (ret != VBAN_HEADER_SIZE + payload_bytes)
-			fprintf(stderr, "Error: Failed to send VBAN packet. errno=%d\n", errno);
+	if (addr.sin_addr.s_addr)
+		thread_loop_sendto(ctx, ctx.vban_packet, VBAN_HEADER_SIZE + payload_bytes, addr);
+
+	if (fec_group_size != ctx.fec.get_group_size())
+		ctx.fec.reset(fec_group_size);
+
+	if (uint32_t parity_bytes = ctx.fec.add(ctx.vban_packet, VBAN_HEADER_SIZE + payload_bytes)) {
+		addr.sin_port = htons(ntohs(addr.sin_port) + VBAN_FEC_PORT_OFFSET);
+		if (addr.sin_addr.s_addr)
+			thread_loop_sendto(ctx, ctx.fec.parity(), parity_bytes, addr);
 	}
 
+	VBAN_TRACE4(send, ctx.vban_header.nuFrame, ctx.vban_packet_frames, VBAN_HEADER_SIZE + payload_bytes,
+		    ctx.send_soon ? 0 : ctx.next_send.time_since_epoch().count());
 	ctx.vban_header.nuFrame++;
+	stats.n_packets.fetch_add(1, std::memory_order_relaxed);
 
 	return ctx.vban_packet_frames;
 }
 
+/* Schedules the next packet at the time the host captured its first frame, plus the
+ * prebuffer latency. Returns false if the host does not provide the system time. */
+static bool next_send_from_timeline(struct loop_context &ctx)
+{
+	int64_t system_time;
+	if (!ctx.clock_anchored || !ctx.system_time_at(ctx.frames_out, system_time))
+		return false;
+
+	auto next_send = ctx.clock_anchor + std::chrono::nanoseconds(system_time - ctx.clock_anchor_system_time);
+
+	/* The host clock is not the same as steady_clock. Follow it unless it has
+	 * drifted too far, then anchor it again at the current pace. */
+	auto diff = next_send - ctx.next_send;
+	if (diff > std::chrono::nanoseconds(timeline_tolerance_ns) ||
+	    diff < -std::chrono::nanoseconds(timeline_tolerance_ns)) {
+		next_send = ctx.next_send +
+			    std::chrono::nanoseconds((int64_t)(ctx.vban_packet_frames * ctx.ns_per_frame));
+		ctx.clock_anchor = next_send;
+		ctx.clock_anchor_system_time = system_time;
+	}
+
+	ctx.next_send = next_send;
+	return true;
+}
+
+/* Returns the depth of the buffer to be kept ahead of the wire. */
+static uint32_t target_buffer_frames(const struct loop_context &ctx)
+{
+	if (ctx.latency_target_frames)
+		return std::max(ctx.latency_target_frames, ctx.vban_packet_frames);
+
+	/* One block to arrive and one packet to be filled, plus the jitter of the blocks. */
+	uint32_t jitter_frames = (uint32_t)(ctx.jitter.peak_us * jitter_margin * 1e3 / ctx.ns_per_frame);
+	return ctx.last_packet_frames + ctx.vban_packet_frames + jitter_frames;
+}
+
 void CVBANPluginProcessor::thread_loop()
 {
 	struct loop_context ctx;
@@ -190,41 +774,84 @@ void CVBANPluginProcessor::thread_loop()
 		return;
 	}
 
-	double sample_us = 1e6 / processSetup.sampleRate;
-	bool first = true;
-
 	while (thread_loop_obtain_from_queue(ctx)) {
 
-		if (!ctx.last_packet_size) {
+		if (ctx.idle) {
+			ctx.interleaved_audio.clear();
+			ctx.time_anchors.clear();
 			ctx.send_soon = true;
 			continue;
 		}
 
-		uint32_t upper_buffer_bytes = ctx.last_packet_size * 2;
-		while (upper_buffer_bytes < ctx.last_packet_size + ctx.vban_packet_frames * ctx.vban_frame_bytes)
-			upper_buffer_bytes += ctx.last_packet_size;
+		if (!ctx.last_packet_frames) {
+			ctx.send_soon = true;
+			continue;
+		}
 
-		if (first) {
+		uint32_t upper_buffer_frames = target_buffer_frames(ctx);
+
+		if (ctx.prebuffering) {
 			/* Wait until enough packets have arrived. */
-			if (ctx.interleaved_audio.size() < upper_buffer_bytes) {
+			if (ctx.buffered_frames() < upper_buffer_frames) {
 				ctx.send_soon = true;
 				continue;
 			}
 
 			ctx.send_soon = false;
-			first = false;
+			ctx.prebuffering = false;
+			ctx.clock_anchored = ctx.system_time_at(ctx.frames_out, ctx.clock_anchor_system_time);
+			ctx.clock_anchor = std::chrono::steady_clock::now();
+			ctx.next_send = ctx.clock_anchor;
+			ctx.clock_anchor_buffer_frames = upper_buffer_frames;
+		} else if (ctx.buffered_frames() > upper_buffer_frames * backlog_resync_factor) {
+			/* After a stall, the pacing below would take too long to drain
+			 * the backlog. Jump to the live edge instead. */
+			discard_backlog(ctx, stats, ctx.buffered_frames() - upper_buffer_frames);
+			stats.n_backlog_resyncs.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		if (ctx.clock_anchored && !ctx.prebuffering) {
+			/* Move the timeline when the target has changed by a packet or more. */
+			int64_t diff = (int64_t)upper_buffer_frames - ctx.clock_anchor_buffer_frames;
+			if (diff >= ctx.vban_packet_frames || diff <= -(int64_t)ctx.vban_packet_frames) {
+				auto shift = std::chrono::nanoseconds((int64_t)(diff * ctx.ns_per_frame));
+				ctx.clock_anchor += shift;
+				ctx.next_send += shift;
+				ctx.clock_anchor_buffer_frames = upper_buffer_frames;
+			}
+		}
+
+		uint32_t peak_buffer_frames = ctx.buffered_frames();
+
+		if (peak_buffer_frames < ctx.vban_packet_frames && !ctx.send_soon && ctx.realtime) {
+			/* Woken before the packet is due, wait for the audio until then. */
+			auto due = ctx.txtime ? ctx.next_send - txtime_lead : ctx.next_send;
+			if (std::chrono::steady_clock::now() < due)
+				continue;
+			conceal_underrun(ctx, stats);
+		} else if (peak_buffer_frames >= ctx.vban_packet_frames) {
+			auto last = ctx.interleaved_audio.begin() + (ctx.vban_packet_frames - 1) * ctx.vban_channels;
+			std::copy(last, last + ctx.vban_channels, ctx.last_frame.begin());
 		}
 
-		uint32_t peak_buffer_size = ctx.interleaved_audio.size();
+		if (ctx.txtime)
+			ctx.launch_time = std::max(ctx.next_send, std::chrono::steady_clock::now() + txtime_min_lead);
 
 		uint32_t n_frames = thread_loop_send(ctx);
 
 		if (n_frames) {
-			double duration_us = n_frames * sample_us;
-			if (ctx.interleaved_audio.size() < ctx.last_packet_size) {
-				/* If the are small number of remaining samples, add 1% or 1us to the wait time. */
+			ctx.latency_frames += (peak_buffer_frames - ctx.latency_frames) * 0.05;
+			stats.latency_frames.store((uint32_t)(ctx.latency_frames + 0.5), std::memory_order_relaxed);
+		}
+
+		if (n_frames && next_send_from_timeline(ctx)) {
+			ctx.send_soon = false;
+		} else if (n_frames) {
+			double duration_us = n_frames * ctx.ns_per_frame * 1e-3;
+			if (peak_buffer_frames + ctx.last_packet_frames < upper_buffer_frames) {
+				/* If the buffer is below the target by more than a block, add 1% or 1us to the wait time. */
 				duration_us = duration_us < 1e2 ? duration_us + 1.0 : duration_us * 1.01;
-			} else if (peak_buffer_size > upper_buffer_bytes) {
+			} else if (peak_buffer_frames > upper_buffer_frames) {
 				/* If the are large number of remaining samples, subtract 1% or 1us to the wait time. */
 				duration_us = duration_us < 1e2 ? duration_us - 1.0 : duration_us * 0.99;
 			}
@@ -234,6 +861,47 @@ void CVBANPluginProcessor::thread_loop()
 			ctx.send_soon = true;
 		}
 	}
+
+	if (ctx.txtime)
+		drain_txtime_errors(ctx);
+}
+
+/* Same as `thread_loop_send` but encodes the packet directly into the shm ring. */
+uint32_t CVBANPluginProcessor::thread_loop_publish(struct loop_context &ctx)
+{
+	uint32_t payload_samples = ctx.vban_packet_frames * ctx.vban_channels;
+
+	uint16_t port;
+	{
+		std::unique_lock lk(props_mutex);
+		port = dest_port;
+	}
+	if (port != ctx.shm_port) {
+		ctx.shm_port = port;
+		if (!shm.open(port, shm_ring_slots, shm_packet_size_max)) {
+			ctx.idle = true;
+			return 0;
+		}
+	}
+	if (ctx.vban_header.nuFrame % shm_serve_interval == 0)
+		shm.serve_readers();
+
+	uint8_t *packet = shm.ring.begin();
+	memcpy(packet, &ctx.vban_header, VBAN_HEADER_SIZE);
+	uint8_t *payload = packet + VBAN_HEADER_SIZE;
+	uint32_t payload_bytes = ctx.packetizer.encode(ctx.interleaved_audio.data(), ctx.vban_channels,
+						       ctx.vban_packet_frames, ctx.vban_format, payload);
+	shm.ring.commit(VBAN_HEADER_SIZE + payload_bytes);
+
+	ctx.interleaved_audio.erase(ctx.interleaved_audio.begin(), ctx.interleaved_audio.begin() + payload_samples);
+	ctx.frames_out += ctx.vban_packet_frames;
+
+	VBAN_TRACE4(send, ctx.vban_header.nuFrame, ctx.vban_packet_frames, VBAN_HEADER_SIZE + payload_bytes,
+		    ctx.send_soon ? 0 : ctx.next_send.time_since_epoch().count());
+	ctx.vban_header.nuFrame++;
+	stats.n_packets.fetch_add(1, std::memory_order_relaxed);
+
+	return ctx.vban_packet_frames;
 }
 
 void *CVBANPluginProcessor::thread_entry(void *data)
@@ -243,6 +911,8 @@ void *CVBANPluginProcessor::thread_entry(void *data)
 	while (ptr->cont && !ptr->has_error)
 		ptr->thread_loop();
 
+	ptr->group_member.leave();
+
 	return NULL;
 }
 }
@@ -0,0 +1,338 @@
+/* Instantiates many VBAN processors in one process and drives them like a host.
+ *
+ * Each audio thread owns a share of the instances and calls `process()` on all
+ * of them once per block period, sleeping until the next period in between.
+ * The run reports process-wide CPU usage, context switches, wake-ups per second
+ * and the distribution of `process()` call durations for each instance count.
+ *
+ * Usage: vban-bench-instances [-n 1,10,100] [-t audio_threads] [-b block] [-r rate]
+ *                             [-s seconds] [-p port] [-o pass|mute|bypass] [--in-place]
+ *                             [--max-p99-us us] [--max-cpu-pct pct]
+ * The output mode is set on every instance, --in-place gives the same buffers as the
+ * input and the output bus. The bytes of samples touched by `process()` are reported
+ * per frame of one instance.
+ * With --max-p99-us or --max-cpu-pct (percent of one core per instance), the
+ * exit status is non-zero if any run exceeds the limit. ctest runs it this way
+ * as `vban-bench-instances-regression-<instances>`, see CMakeLists.txt. */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+#include "vban_processor.h"
+#include "paramids.h"
+#include "public.sdk/source/vst/hosting/parameterchanges.h"
+
+using namespace Steinberg;
+using namespace NagaterNet;
+
+struct bench_config
+{
+	std::vector<uint32_t> n_instances = {1, 10, 50, 100};
+	uint32_t n_audio_threads = 1;
+	uint32_t block_size = 256;
+	double sample_rate = 48000.0;
+	double seconds = 10.0;
+	uint16_t port = 6980;
+	double max_p99_us = 0.0;
+	double max_cpu_pct = 0.0;
+	uint32_t output_mode = output_pass_through;
+	bool in_place = false;
+};
+
+struct bench_result
+{
+	double cpu_pct;
+	double ctx_switches_per_sec;
+	double wakeups_per_sec;
+	double p50_us;
+	double p99_us;
+	double max_us;
+	uint64_t n_late_cycles;
+	double bytes_per_frame;
+};
+
+/* Exposes the statistics of the processor. */
+struct bench_processor : CVBANPluginProcessor
+{
+	uint64_t process_bytes() const
+	{
+		return stats.n_process_bytes.load(std::memory_order_relaxed);
+	}
+};
+
+struct instance
+{
+	bench_processor *proc;
+	std::vector<float> out_l, out_r;
+	float *out_ptrs[2];
+	Vst::AudioBusBuffers in_bus, out_bus;
+};
+
+static void set_params(CVBANPluginProcessor *proc, uint16_t port, uint32_t output_mode, uint32_t block_size)
+{
+	Vst::ParameterChanges changes;
+	int32 index;
+	const uint32_t addr[4] = {127, 0, 0, 1};
+	for (int i = 0; i < 4; i++)
+		changes.addParameterData(paramid_ipv4_0 + i, index)->addPoint(0, addr[i] / 255.0, index);
+	changes.addParameterData(paramid_port, index)->addPoint(0, port / 65535.0, index);
+	changes.addParameterData(paramid_output_mode, index)
+		->addPoint(0, (double)output_mode / (output_mode_count - 1), index);
+
+	std::vector<float> silence(block_size);
+	float *ptrs[2] = {silence.data(), silence.data()};
+	Vst::AudioBusBuffers bus;
+	bus.numChannels = 2;
+	bus.silenceFlags = 3;
+	bus.channelBuffers32 = ptrs;
+
+	Vst::ProcessData data;
+	data.processMode = Vst::kRealtime;
+	data.symbolicSampleSize = Vst::kSample32;
+	data.numSamples = 0;
+	data.numInputs = 1;
+	data.numOutputs = 1;
+	data.inputs = &bus;
+	data.outputs = &bus;
+	data.inputParameterChanges = &changes;
+	proc->process(data);
+}
+
+static double timeval_sec(const struct timeval &tv)
+{
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static bench_result run(const bench_config &cfg, uint32_t n)
+{
+	Vst::ProcessSetup setup;
+	setup.processMode = Vst::kRealtime;
+	setup.symbolicSampleSize = Vst::kSample32;
+	setup.maxSamplesPerBlock = (int32)cfg.block_size;
+	setup.sampleRate = cfg.sample_rate;
+
+	std::vector<float> in_l(cfg.block_size), in_r(cfg.block_size);
+	for (uint32_t i = 0; i < cfg.block_size; i++) {
+		in_l[i] = 0.5f * (float)std::sin(2.0 * M_PI * 440.0 * i / cfg.sample_rate);
+		in_r[i] = in_l[i];
+	}
+	float *in_ptrs[2] = {in_l.data(), in_r.data()};
+
+	std::vector<instance> instances(n);
+	for (auto &inst : instances) {
+		inst.proc = new bench_processor;
+		inst.proc->initialize(nullptr);
+		inst.proc->setupProcessing(setup);
+		inst.proc->setActive(true);
+		inst.proc->setProcessing(true);
+		set_params(inst.proc, cfg.port, cfg.output_mode, cfg.block_size);
+
+		inst.out_l.resize(cfg.block_size);
+		inst.out_r.resize(cfg.block_size);
+		inst.out_ptrs[0] = inst.out_l.data();
+		inst.out_ptrs[1] = inst.out_r.data();
+		inst.in_bus.numChannels = 2;
+		inst.in_bus.silenceFlags = 0;
+		inst.in_bus.channelBuffers32 = cfg.in_place ? inst.out_ptrs : in_ptrs;
+		inst.out_bus.numChannels = 2;
+		inst.out_bus.silenceFlags = 0;
+		inst.out_bus.channelBuffers32 = inst.out_ptrs;
+	}
+
+	const auto period = std::chrono::nanoseconds((int64_t)(1e9 * cfg.block_size / cfg.sample_rate));
+	const uint64_t n_cycles = (uint64_t)(cfg.seconds * cfg.sample_rate / cfg.block_size);
+	const uint32_t n_threads = std::max(1u, std::min(cfg.n_audio_threads, n));
+
+	std::vector<std::vector<uint32_t>> durations(n_threads);
+	std::vector<uint64_t> n_late(n_threads);
+
+	struct rusage ru0, ru1;
+	getrusage(RUSAGE_SELF, &ru0);
+	auto t0 = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for (uint32_t it = 0; it < n_threads; it++) {
+		threads.emplace_back([&, it]() {
+			auto &dur = durations[it];
+			dur.reserve(n_cycles * (n / n_threads + 1));
+
+			Vst::ProcessData data;
+			data.processMode = Vst::kRealtime;
+			data.symbolicSampleSize = Vst::kSample32;
+			data.numSamples = (int32)cfg.block_size;
+			data.numInputs = 1;
+			data.numOutputs = 1;
+
+			auto next = t0;
+			for (uint64_t c = 0; c < n_cycles; c++) {
+				for (uint32_t i = it; i < n; i += n_threads) {
+					auto &inst = instances[i];
+					data.inputs = &inst.in_bus;
+					data.outputs = &inst.out_bus;
+					if (cfg.in_place) {
+						/* The host writes the input into the buffers shared with the output. */
+						inst.out_l = in_l;
+						inst.out_r = in_r;
+					}
+
+					auto s = std::chrono::steady_clock::now();
+					inst.proc->process(data);
+					auto e = std::chrono::steady_clock::now();
+					dur.push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(e - s)
+							      .count());
+				}
+
+				next += period;
+				if (std::chrono::steady_clock::now() > next)
+					n_late[it]++;
+				std::this_thread::sleep_until(next);
+			}
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+
+	auto t1 = std::chrono::steady_clock::now();
+	getrusage(RUSAGE_SELF, &ru1);
+
+	uint64_t n_bytes = 0;
+	for (auto &inst : instances) {
+		n_bytes += inst.proc->process_bytes();
+		inst.proc->setProcessing(false);
+		inst.proc->setActive(false);
+		inst.proc->terminate();
+		inst.proc->release();
+	}
+
+	std::vector<uint32_t> all;
+	for (auto &d : durations)
+		all.insert(all.end(), d.begin(), d.end());
+	std::sort(all.begin(), all.end());
+
+	const double elapsed = std::chrono::duration<double>(t1 - t0).count();
+	const double cpu = timeval_sec(ru1.ru_utime) - timeval_sec(ru0.ru_utime) + timeval_sec(ru1.ru_stime) -
+			   timeval_sec(ru0.ru_stime);
+	const double nvcsw = (double)(ru1.ru_nvcsw - ru0.ru_nvcsw);
+	const double nivcsw = (double)(ru1.ru_nivcsw - ru0.ru_nivcsw);
+
+	auto percentile = [&](double p) {
+		return all.empty() ? 0.0 : all[std::min(all.size() - 1, (size_t)(p * all.size()))] * 1e-3;
+	};
+
+	bench_result r;
+	r.cpu_pct = 100.0 * cpu / elapsed;
+	r.ctx_switches_per_sec = (nvcsw + nivcsw) / elapsed;
+	r.wakeups_per_sec = nvcsw / elapsed; /* each voluntary switch is followed by a wake-up */
+	r.p50_us = percentile(0.50);
+	r.p99_us = percentile(0.99);
+	r.max_us = all.empty() ? 0.0 : all.back() * 1e-3;
+	r.bytes_per_frame = (double)n_bytes / ((double)n_cycles * cfg.block_size * n);
+	r.n_late_cycles = 0;
+	for (auto l : n_late)
+		r.n_late_cycles += l;
+	return r;
+}
+
+static std::vector<uint32_t> parse_list(const char *s)
+{
+	std::vector<uint32_t> ret;
+	while (*s) {
+		char *end;
+		ret.push_back((uint32_t)strtoul(s, &end, 10));
+		s = *end == ',' ? end + 1 : end;
+		if (end == s)
+			break;
+	}
+	return ret;
+}
+
+/* Returns `output_mode_count` for an unknown name. */
+static uint32_t parse_output_mode(const char *s)
+{
+	const char *names[output_mode_count] = {"pass", "mute", "bypass"};
+	uint32_t i = 0;
+	while (i < output_mode_count && strcmp(s, names[i]))
+		i++;
+	return i;
+}
+
+int main(int argc, char **argv)
+{
+	bench_config cfg;
+
+	for (int i = 1; i < argc; i++) {
+		const char *a = argv[i];
+		if (!strcmp(a, "--in-place")) {
+			cfg.in_place = true;
+			continue;
+		}
+		const char *v = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (!v) {
+			fprintf(stderr, "Error: missing value for %s\n", a);
+			return 2;
+		}
+		if (!strcmp(a, "-n"))
+			cfg.n_instances = parse_list(v);
+		else if (!strcmp(a, "-t"))
+			cfg.n_audio_threads = (uint32_t)atoi(v);
+		else if (!strcmp(a, "-b"))
+			cfg.block_size = (uint32_t)atoi(v);
+		else if (!strcmp(a, "-r"))
+			cfg.sample_rate = atof(v);
+		else if (!strcmp(a, "-s"))
+			cfg.seconds = atof(v);
+		else if (!strcmp(a, "-p"))
+			cfg.port = (uint16_t)atoi(v);
+		else if (!strcmp(a, "-o"))
+			cfg.output_mode = parse_output_mode(v);
+		else if (!strcmp(a, "--max-p99-us"))
+			cfg.max_p99_us = atof(v);
+		else if (!strcmp(a, "--max-cpu-pct"))
+			cfg.max_cpu_pct = atof(v);
+		else {
+			fprintf(stderr, "Error: unknown option %s\n", a);
+			return 2;
+		}
+		i++;
+	}
+
+	if (cfg.output_mode >= output_mode_count) {
+		fprintf(stderr, "Error: output mode has to be pass, mute or bypass\n");
+		return 2;
+	}
+
+	printf("%9s %9s %11s %12s %10s %10s %10s %10s %6s %8s\n", "instances", "cpu%", "cpu%/inst", "ctxsw/s",
+	       "wakeups/s", "p50[us]", "p99[us]", "max[us]", "late", "B/frame");
+
+	int ret = 0;
+	for (uint32_t n : cfg.n_instances) {
+		if (!n)
+			continue;
+		bench_result r = run(cfg, n);
+		printf("%9u %9.1f %11.3f %12.0f %10.0f %10.2f %10.2f %10.2f %6llu %8.1f\n", n, r.cpu_pct, r.cpu_pct / n,
+		       r.ctx_switches_per_sec, r.wakeups_per_sec, r.p50_us, r.p99_us, r.max_us,
+		       (unsigned long long)r.n_late_cycles, r.bytes_per_frame);
+		fflush(stdout);
+
+		if (cfg.max_p99_us > 0.0 && r.p99_us > cfg.max_p99_us) {
+			fprintf(stderr, "Error: p99 process() time %.2f us exceeds %.2f us with %u instances\n",
+				r.p99_us, cfg.max_p99_us, n);
+			ret = 1;
+		}
+		if (cfg.max_cpu_pct > 0.0 && r.cpu_pct / n > cfg.max_cpu_pct) {
+			fprintf(stderr, "Error: CPU usage %.3f%% per instance exceeds %.3f%% with %u instances\n",
+				r.cpu_pct / n, cfg.max_cpu_pct, n);
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,293 @@
+/* Measures the lossless formats on program material.
+ *
+ * Usage: vban-bench-lossless [-b bits] [-c channels] [-d seconds] [file.wav ...]
+ *   -b bits      16 or 24 (default 24)
+ *   -c channels  channels of the synthesized material (default 2)
+ *   -d seconds   duration of the synthesized material (default 30)
+ *
+ * WAV files in 16-bit or 24-bit PCM or 32-bit float are read as they are.
+ * Without files, material is synthesized at 48 kHz: notes of harmonic tones
+ * with a noise floor at mixing and at quiet levels, pink noise, and white
+ * noise, which does not compress and shows the cost of the verbatim fallback.
+ *
+ * The audio is cut into packets of the size the sender thread uses over UDP.
+ * For each material the report lists the compressed size relative to the PCM
+ * payload, the bit rate, and the encode and decode time per second of one
+ * channel. Every packet is decoded and compared with the PCM samples of the
+ * same bit depth. */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "packetizer.h"
+#include "vban_lossless.h"
+
+struct material
+{
+	std::string name;
+	uint32_t n_channels = 0;
+	uint32_t sample_rate = 0;
+	std::vector<float> samples; /* interleaved */
+};
+
+static uint32_t get_le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool read_wav(const char *path, material &m)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		fprintf(stderr, "Error: Cannot open %s\n", path);
+		return false;
+	}
+	std::vector<uint8_t> data;
+	uint8_t buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		data.insert(data.end(), buf, buf + n);
+	fclose(fp);
+
+	if (data.size() < 12 || memcmp(data.data(), "RIFF", 4) || memcmp(data.data() + 8, "WAVE", 4)) {
+		fprintf(stderr, "Error: %s is not a WAV file\n", path);
+		return false;
+	}
+
+	uint32_t format = 0, bits = 0;
+	for (size_t pos = 12; pos + 8 <= data.size();) {
+		const uint8_t *chunk = data.data() + pos;
+		size_t size = std::min<size_t>(get_le32(chunk + 4), data.size() - pos - 8);
+		if (!memcmp(chunk, "fmt ", 4) && size >= 16) {
+			format = get_le16(chunk + 8);
+			m.n_channels = get_le16(chunk + 10);
+			m.sample_rate = get_le32(chunk + 12);
+			bits = get_le16(chunk + 22);
+			if (format == 0xFFFE && size >= 26)
+				format = get_le16(chunk + 32); /* WAVE_FORMAT_EXTENSIBLE */
+		} else if (!memcmp(chunk, "data", 4) && m.n_channels) {
+			const uint8_t *p = chunk + 8;
+			if (format == 1 && bits == 16) {
+				for (size_t i = 0; i + 2 <= size; i += 2)
+					m.samples.push_back((int16_t)get_le16(p + i) / 32768.0f);
+			} else if (format == 1 && bits == 24) {
+				for (size_t i = 0; i + 3 <= size; i += 3)
+					m.samples.push_back(((int32_t)(get_le32(p + i) << 8) >> 8) / 8388608.0f);
+			} else if (format == 3 && bits == 32) {
+				m.samples.resize(size / 4);
+				memcpy(m.samples.data(), p, m.samples.size() * 4);
+			}
+		}
+		pos += 8 + size + (size & 1);
+	}
+
+	m.samples.resize(m.samples.size() / std::max(1u, m.n_channels) * m.n_channels);
+	if (m.samples.empty() || m.n_channels > 64) {
+		fprintf(stderr, "Error: %s has no 16-bit, 24-bit, or float audio\n", path);
+		return false;
+	}
+	m.name = path;
+	return true;
+}
+
+/* Harmonic notes changing every 250 ms with a decaying envelope, over a noise floor at -96 dBFS. */
+static void synth_tones(material &m, double seconds, float level)
+{
+	std::mt19937 rng(1);
+	std::normal_distribution<float> noise(0.0f, 1.6e-5f);
+	std::uniform_int_distribution<int> note(36, 84);
+	const uint32_t n_frames = (uint32_t)(seconds * m.sample_rate);
+	const uint32_t note_frames = m.sample_rate / 4;
+
+	m.samples.assign((size_t)n_frames * m.n_channels, 0.0f);
+	for (uint32_t ch = 0; ch < m.n_channels; ch++) {
+		double f = 0.0;
+		for (uint32_t i = 0; i < n_frames; i++) {
+			if (i % note_frames == 0)
+				f = 440.0 * std::pow(2.0, (note(rng) - 69) / 12.0);
+			double t = (double)(i % note_frames) / m.sample_rate;
+			double env = std::exp(-4.0 * t);
+			double v = 0.0;
+			for (int h = 1; h <= 6; h++)
+				v += std::sin(2.0 * M_PI * f * h * i / m.sample_rate + ch) / (h * h);
+			m.samples[(size_t)i * m.n_channels + ch] = (float)(level * env * v * 0.6) + noise(rng);
+		}
+	}
+}
+
+/* Pink noise from the Voss-McCartney algorithm with 16 rows. */
+static void synth_pink(material &m, double seconds, float level)
+{
+	std::mt19937 rng(2);
+	std::uniform_real_distribution<float> white(-1.0f, 1.0f);
+	const uint32_t n_frames = (uint32_t)(seconds * m.sample_rate);
+
+	m.samples.assign((size_t)n_frames * m.n_channels, 0.0f);
+	for (uint32_t ch = 0; ch < m.n_channels; ch++) {
+		float rows[16] = {};
+		float sum = 0.0f;
+		for (uint32_t i = 0; i < n_frames; i++) {
+			int r = i ? __builtin_ctz(i) : 0;
+			if (r < 16) {
+				sum -= rows[r];
+				rows[r] = white(rng);
+				sum += rows[r];
+			}
+			m.samples[(size_t)i * m.n_channels + ch] = level * (sum + white(rng)) / 17.0f;
+		}
+	}
+}
+
+static void synth_white(material &m, double seconds, float level)
+{
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> white(-level, level);
+	m.samples.resize((size_t)(seconds * m.sample_rate) * m.n_channels);
+	for (auto &s : m.samples)
+		s = white(rng);
+}
+
+/* PCM samples of the same bit depth, as the receiver reads them from the PCM formats. */
+static void pcm_reference(const packetizer &pcm, const float *src, uint32_t n_channels, uint32_t n_frames,
+			  uint32_t bits, uint8_t format_bit, int32_t *dst)
+{
+	uint8_t payload[VBAN_PROTOCOL_MAX_SIZE * 4];
+	pcm.encode(src, n_channels, n_frames, format_bit, payload);
+	const uint32_t bytes = bits / 8;
+	for (uint32_t i = 0; i < n_channels * n_frames; i++) {
+		uint32_t v = 0;
+		for (uint32_t b = 0; b < bytes; b++)
+			v |= (uint32_t)payload[i * bytes + b] << (8 * b);
+		dst[i] = (int32_t)(v << (32 - bits)) >> (32 - bits);
+	}
+}
+
+static void run(const material &m, uint32_t bits)
+{
+	const uint8_t pcm_format = bits == 16 ? VBAN_BITFMT_16_INT : VBAN_BITFMT_24_INT;
+	const uint8_t format = VBAN_CODEC_USER | pcm_format;
+
+	packetizer lossless, pcm;
+	lossless.select(m.n_channels, format);
+	pcm.select(m.n_channels, pcm_format);
+
+	const uint32_t packet_frames = std::min(256u, lossless.max_frames(m.n_channels, VBAN_DATA_MAX_SIZE));
+	const uint32_t n_packets = (uint32_t)(m.samples.size() / m.n_channels / packet_frames);
+	if (!packet_frames || !n_packets)
+		return;
+
+	/* Encodes everything first to time it apart from the checks. */
+	std::vector<uint8_t> payloads((size_t)n_packets * VBAN_DATA_MAX_SIZE);
+	std::vector<uint32_t> sizes(n_packets);
+	auto t0 = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < n_packets; i++) {
+		sizes[i] = lossless.encode(m.samples.data() + (size_t)i * packet_frames * m.n_channels, m.n_channels,
+					   packet_frames, format, payloads.data() + (size_t)i * VBAN_DATA_MAX_SIZE);
+	}
+	auto t1 = std::chrono::steady_clock::now();
+
+	std::vector<int32_t> decoded((size_t)n_packets * packet_frames * m.n_channels);
+	uint32_t n_failed = 0;
+	for (uint32_t i = 0; i < n_packets; i++) {
+		int32_t *dst = decoded.data() + (size_t)i * packet_frames * m.n_channels;
+		if (!vban_lossless_decode(payloads.data() + (size_t)i * VBAN_DATA_MAX_SIZE, sizes[i], m.n_channels,
+					  packet_frames, bits, dst))
+			n_failed++;
+	}
+	auto t2 = std::chrono::steady_clock::now();
+
+	uint64_t n_mismatches = 0, compressed = 0, largest = 0;
+	std::vector<int32_t> reference(packet_frames * m.n_channels);
+	for (uint32_t i = 0; i < n_packets; i++) {
+		const size_t offset = (size_t)i * packet_frames * m.n_channels;
+		pcm_reference(pcm, m.samples.data() + offset, m.n_channels, packet_frames, bits, pcm_format,
+			      reference.data());
+		for (uint32_t j = 0; j < packet_frames * m.n_channels; j++)
+			n_mismatches += reference[j] != decoded[offset + j];
+		compressed += sizes[i];
+		largest = std::max<uint64_t>(largest, sizes[i]);
+	}
+
+	const double pcm_bytes = (double)n_packets * pcm.payload_bytes(m.n_channels, packet_frames);
+	const double channel_sec = (double)n_packets * packet_frames * m.n_channels / m.sample_rate;
+	const double audio_sec = (double)n_packets * packet_frames / m.sample_rate;
+	const double wire_bytes = compressed + (double)n_packets * VBAN_HEADER_SIZE;
+	printf("%-24s %3u %5u %6.1f%% %9.1f %10.1f %10.1f %6llu %6u %8llu\n", m.name.c_str(), m.n_channels,
+	       packet_frames, 100.0 * compressed / pcm_bytes, wire_bytes * 8e-3 / audio_sec,
+	       std::chrono::duration<double, std::micro>(t1 - t0).count() / channel_sec,
+	       std::chrono::duration<double, std::micro>(t2 - t1).count() / channel_sec, (unsigned long long)largest,
+	       n_failed, (unsigned long long)n_mismatches);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t bits = 24;
+	uint32_t n_channels = 2;
+	double seconds = 30.0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "b:c:d:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bits = atoi(optarg) == 16 ? 16 : 24;
+			break;
+		case 'c':
+			n_channels = std::clamp(atoi(optarg), 1, 64);
+			break;
+		case 'd':
+			seconds = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-b bits] [-c channels] [-d seconds] [file.wav ...]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	std::vector<material> materials;
+	for (int i = optind; i < argc; i++) {
+		material m;
+		if (read_wav(argv[i], m))
+			materials.push_back(std::move(m));
+	}
+	if (optind == argc) {
+		const struct
+		{
+			const char *name;
+			void (*synth)(material &, double, float);
+			float level;
+		} synths[] = {
+			{"tones -12 dBFS", synth_tones, 0.25f},
+			{"tones -40 dBFS", synth_tones, 0.01f},
+			{"pink noise -20 dBFS", synth_pink, 0.1f},
+			{"white noise -6 dBFS", synth_white, 0.5f},
+		};
+		for (auto &s : synths) {
+			material m;
+			m.name = s.name;
+			m.n_channels = n_channels;
+			m.sample_rate = 48000;
+			s.synth(m, seconds, s.level);
+			materials.push_back(std::move(m));
+		}
+	}
+
+	printf("%-24s %3s %5s %7s %9s %10s %10s %6s %6s %8s\n", "material", "ch", "f/pkt", "size", "kbit/s",
+	       "enc_us/chs", "dec_us/chs", "maxB", "failed", "mismatch");
+	for (auto &m : materials)
+		run(m, bits);
+
+	return 0;
+}
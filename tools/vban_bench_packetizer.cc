@@ -0,0 +1,114 @@
+/* Compares the specialized packetizer instances against the generic one.
+ *
+ * For each channel count and sample format, blocks of planar audio are
+ * interleaved and encoded into packets as the sender thread does, and the
+ * time per frame is reported for both instances. The two instances are run
+ * in turns and the fastest round of each is kept, so that a busy machine
+ * does not favour one of them.
+ *
+ * Usage: vban-bench-packetizer [seconds_of_audio_per_round [rounds]] */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "packetizer.h"
+
+static const char *format_name(uint8_t format_bit)
+{
+	switch (format_bit) {
+	case VBAN_BITFMT_32_FLOAT:
+		return "float32";
+	case VBAN_BITFMT_16_INT:
+		return "int16";
+	case VBAN_BITFMT_24_INT:
+		return "int24";
+	case VBAN_BITFMT_12_INT:
+		return "int12";
+	case VBAN_BITFMT_10_INT:
+		return "int10";
+	case VBAN_CODEC_USER | VBAN_BITFMT_16_INT:
+		return "lossless16";
+	case VBAN_CODEC_USER | VBAN_BITFMT_24_INT:
+		return "lossless24";
+	}
+	return "?";
+}
+
+/* Returns nanoseconds per frame. */
+static double run(const packetizer &p, uint32_t n_channels, uint8_t format_bit, uint32_t n_frames_total)
+{
+	const uint32_t block = 256;
+	const uint32_t packet_frames = std::min(256u, p.max_frames(n_channels, VBAN_DATA_MAX_SIZE));
+
+	std::vector<std::vector<float>> planes_data(n_channels, std::vector<float>(block));
+	std::vector<const float *> planes(n_channels);
+	for (uint32_t ch = 0; ch < n_channels; ch++) {
+		for (uint32_t i = 0; i < block; i++)
+			planes_data[ch][i] = 0.5f * (float)std::sin(0.01 * (i + 1) * (ch + 1));
+		planes[ch] = planes_data[ch].data();
+	}
+
+	std::vector<float> interleaved(block * n_channels * 2);
+	std::vector<uint8_t> payload(VBAN_DATA_MAX_SIZE);
+	uint32_t buffered = 0;
+	uint64_t checksum = 0;
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (uint32_t done = 0; done < n_frames_total; done += block) {
+		if (buffered + block > interleaved.size() / n_channels)
+			interleaved.resize((buffered + block) * n_channels);
+		p.interleave(planes.data(), n_channels, block, interleaved.data() + buffered * n_channels);
+		buffered += block;
+
+		uint32_t consumed = 0;
+		while (buffered - consumed >= packet_frames) {
+			uint32_t size = p.encode(interleaved.data() + consumed * n_channels, n_channels, packet_frames,
+						 format_bit, payload.data());
+			checksum += payload[size - 1];
+			consumed += packet_frames;
+		}
+		std::copy(interleaved.begin() + consumed * n_channels, interleaved.begin() + buffered * n_channels,
+			  interleaved.begin());
+		buffered -= consumed;
+	}
+	auto t1 = std::chrono::steady_clock::now();
+
+	/* Keeps the work from being optimized away. */
+	if (checksum == 1)
+		fprintf(stderr, " ");
+
+	return std::chrono::duration<double, std::nano>(t1 - t0).count() / n_frames_total;
+}
+
+int main(int argc, char **argv)
+{
+	double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+	int rounds = argc > 2 ? atoi(argv[2]) : 5;
+	const uint32_t n_frames = (uint32_t)(seconds * 48000);
+
+	static const uint32_t channel_counts[] = {1, 2, 4, 8, 16};
+
+	printf("%8s %10s %14s %14s %8s\n", "channels", "format", "generic[ns/f]", "special[ns/f]", "speedup");
+
+	for (uint32_t n_channels : channel_counts) {
+		for (uint8_t format_bit : packetizer_formats) {
+			packetizer generic, special;
+			generic.select_generic(format_bit);
+			special.select(n_channels, format_bit);
+
+			double t_generic = INFINITY, t_special = INFINITY;
+			for (int r = 0; r < rounds; r++) {
+				t_generic = std::min(t_generic, run(generic, n_channels, format_bit, n_frames));
+				t_special = std::min(t_special, run(special, n_channels, format_bit, n_frames));
+			}
+
+			printf("%8u %10s %14.2f %14.2f %7.2fx%s\n", n_channels, format_name(format_bit), t_generic,
+			       t_special, t_generic / t_special, special.specialized ? "" : " (not specialized)");
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,280 @@
+/* Compares the shared memory transport with UDP loopback.
+ *
+ * Usage: vban-bench-shm [-d seconds] [-c channels] [-t poll_us] [-f]
+ *   -d seconds   duration of the audio streamed through each transport (default 5)
+ *   -c channels  32-bit float channels (default 2)
+ *   -t poll_us   sleep between polls of the shm reader in microseconds (default 100)
+ *   -f           flood: send as fast as possible instead of at 48 kHz
+ *
+ * A producer thread builds VBAN packets the same way as the sender thread,
+ * UDP ones limited to the UDP payload size and shm ones with 256 frames, and
+ * a consumer thread reads them. CPU time of both threads is reported per
+ * second of audio, with the delivery latency from the producer to the
+ * consumer. */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "vban.h"
+#include "shm_transport.h"
+
+#define SAMPLE_RATE 48000
+#define BENCH_SHM_PORT 6999
+
+static int64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t thread_cpu_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct bench_config
+{
+	double duration = 5.0;
+	uint32_t n_channels = 2;
+	uint32_t poll_us = 100;
+	bool flood = false;
+};
+
+struct bench_result
+{
+	const char *name;
+	uint32_t packet_frames;
+	uint64_t n_sent = 0;
+	uint64_t n_received = 0;
+	int64_t producer_cpu_ns = 0;
+	int64_t consumer_cpu_ns = 0;
+	std::vector<int32_t> latency_us;
+};
+
+/* Fills the packet and stamps the send time into the first payload bytes. */
+static uint32_t build_packet(uint8_t *packet, uint32_t nu_frame, uint32_t n_channels, uint32_t n_frames)
+{
+	VBanHeader hdr = {};
+	memcpy(&hdr.vban, "VBAN", 4);
+	hdr.format_SR = 3 | VBAN_PROTOCOL_AUDIO; /* 48 kHz */
+	hdr.format_nbs = (uint8_t)(n_frames - 1);
+	hdr.format_nbc = (uint8_t)(n_channels - 1);
+	hdr.format_bit = VBAN_BITFMT_32_FLOAT;
+	strncpy(hdr.streamname, "bench", VBAN_STREAM_NAME_SIZE);
+	hdr.nuFrame = nu_frame;
+	memcpy(packet, &hdr, VBAN_HEADER_SIZE);
+
+	uint32_t payload_bytes = n_frames * n_channels * sizeof(float);
+	float *payload = reinterpret_cast<float *>(packet + VBAN_HEADER_SIZE);
+	for (uint32_t i = 0; i < n_frames * n_channels; i++)
+		payload[i] = (float)((nu_frame + i) & 0xFF) / 256.0f;
+
+	int64_t t = now_ns();
+	memcpy(packet + VBAN_HEADER_SIZE, &t, sizeof(t));
+	return VBAN_HEADER_SIZE + payload_bytes;
+}
+
+static void pace(const bench_config &cfg, int64_t start_ns, uint64_t frames)
+{
+	if (cfg.flood)
+		return;
+	int64_t due = start_ns + (int64_t)(frames * 1e9 / SAMPLE_RATE);
+	int64_t wait = due - now_ns();
+	if (wait > 0)
+		std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+}
+
+static void run_udp(const bench_config &cfg, bench_result &r)
+{
+	r.name = "udp";
+	r.packet_frames = std::min(256u, VBAN_DATA_MAX_SIZE / (cfg.n_channels * (uint32_t)sizeof(float)));
+	uint64_t n_packets = (uint64_t)(cfg.duration * SAMPLE_RATE / r.packet_frames);
+
+	int rx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	int rcvbuf = 4 << 20;
+	setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	struct timeval tv = {0, 200000};
+	setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	bind(rx, (struct sockaddr *)&addr, sizeof(addr));
+	getsockname(rx, (struct sockaddr *)&addr, &len);
+
+	std::atomic<bool> done{false};
+	std::thread consumer([&] {
+		int64_t cpu0 = thread_cpu_ns();
+		uint8_t buf[VBAN_PROTOCOL_MAX_SIZE];
+		while (true) {
+			ssize_t n = recv(rx, buf, sizeof(buf), 0);
+			if (n < 0) {
+				if (done)
+					break;
+				continue;
+			}
+			int64_t t;
+			memcpy(&t, buf + VBAN_HEADER_SIZE, sizeof(t));
+			r.latency_us.push_back((int32_t)((now_ns() - t) / 1000));
+			r.n_received++;
+		}
+		r.consumer_cpu_ns = thread_cpu_ns() - cpu0;
+	});
+
+	int tx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	int64_t cpu0 = thread_cpu_ns();
+	int64_t start = now_ns();
+	uint8_t packet[VBAN_PROTOCOL_MAX_SIZE];
+	for (uint64_t i = 0; i < n_packets; i++) {
+		pace(cfg, start, (i + 1) * r.packet_frames);
+		uint32_t size = build_packet(packet, (uint32_t)i, cfg.n_channels, r.packet_frames);
+		if (sendto(tx, packet, size, 0, (struct sockaddr *)&addr, sizeof(addr)) == (ssize_t)size)
+			r.n_sent++;
+	}
+	r.producer_cpu_ns = thread_cpu_ns() - cpu0;
+
+	done = true;
+	consumer.join();
+	close(tx);
+	close(rx);
+}
+
+static void run_shm(const bench_config &cfg, bench_result &r)
+{
+	r.name = "shm";
+	r.packet_frames = 256;
+	uint64_t n_packets = (uint64_t)(cfg.duration * SAMPLE_RATE / r.packet_frames);
+
+	shm_transport transport;
+	if (!transport.open(BENCH_SHM_PORT, 64, VBAN_HEADER_SIZE + r.packet_frames * cfg.n_channels * sizeof(float)))
+		return;
+
+	std::atomic<bool> done{false};
+	std::atomic<bool> ready{false};
+	std::thread consumer([&] {
+		int fd = shm_transport_connect(BENCH_SHM_PORT);
+		shm_ring_reader ring;
+		bool ok = fd >= 0 && ring.attach(fd);
+		if (fd >= 0)
+			close(fd);
+		ready = true;
+		if (!ok)
+			return;
+
+		int64_t cpu0 = thread_cpu_ns();
+		uint64_t next = 0;
+		while (true) {
+			uint64_t w = ring.write_index();
+			if (w - next > ring.n_slots())
+				next = w - ring.n_slots();
+			for (; next < w; next++) {
+				const uint8_t *packet;
+				uint32_t size;
+				if (ring.peek(next, packet, size) != shm_ring_ready)
+					continue;
+				int64_t t;
+				memcpy(&t, packet + VBAN_HEADER_SIZE, sizeof(t));
+				if (!ring.still_valid(next))
+					continue;
+				r.latency_us.push_back((int32_t)((now_ns() - t) / 1000));
+				r.n_received++;
+			}
+			if (done && next == ring.write_index())
+				break;
+			std::this_thread::sleep_for(std::chrono::microseconds(cfg.poll_us));
+		}
+		r.consumer_cpu_ns = thread_cpu_ns() - cpu0;
+	});
+
+	/* The reader connects through the listening socket like vban-shm-reader. */
+	while (!ready) {
+		transport.serve_readers();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	int64_t cpu0 = thread_cpu_ns();
+	int64_t start = now_ns();
+	for (uint64_t i = 0; i < n_packets; i++) {
+		pace(cfg, start, (i + 1) * r.packet_frames);
+		uint8_t *packet = transport.ring.begin();
+		uint32_t size = build_packet(packet, (uint32_t)i, cfg.n_channels, r.packet_frames);
+		transport.ring.commit(size);
+		r.n_sent++;
+	}
+	r.producer_cpu_ns = thread_cpu_ns() - cpu0;
+
+	done = true;
+	consumer.join();
+}
+
+static double percentile(std::vector<int32_t> &v, double p)
+{
+	if (v.empty())
+		return 0.0;
+	size_t k = std::min(v.size() - 1, (size_t)(p * v.size()));
+	std::nth_element(v.begin(), v.begin() + k, v.end());
+	return v[k];
+}
+
+static void print_result(const bench_config &cfg, bench_result &r)
+{
+	double audio_sec = (double)r.n_sent * r.packet_frames / SAMPLE_RATE;
+	if (audio_sec <= 0.0)
+		audio_sec = 1.0;
+	printf("%-5s %10u %9llu %7llu %12.1f %12.1f %8.0f %8.0f\n", r.name, r.packet_frames,
+	       (unsigned long long)r.n_sent, (unsigned long long)(r.n_sent - r.n_received),
+	       r.producer_cpu_ns * 1e-3 / audio_sec, r.consumer_cpu_ns * 1e-3 / audio_sec,
+	       percentile(r.latency_us, 0.50), percentile(r.latency_us, 0.99));
+	(void)cfg;
+}
+
+int main(int argc, char **argv)
+{
+	bench_config cfg;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "d:c:t:f")) != -1) {
+		switch (opt) {
+		case 'd':
+			cfg.duration = atof(optarg);
+			break;
+		case 'c':
+			cfg.n_channels = std::clamp(atoi(optarg), 1, 8);
+			break;
+		case 't':
+			cfg.poll_us = (uint32_t)atoi(optarg);
+			break;
+		case 'f':
+			cfg.flood = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-d seconds] [-c channels] [-t poll_us] [-f]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	printf("%-5s %10s %9s %7s %12s %12s %8s %8s\n", "", "frames/pkt", "packets", "lost", "tx_us/audio_s",
+	       "rx_us/audio_s", "p50us", "p99us");
+
+	bench_result udp, shm;
+	run_udp(cfg, udp);
+	print_result(cfg, udp);
+	run_shm(cfg, shm);
+	print_result(cfg, shm);
+
+	return 0;
+}
@@ -0,0 +1,765 @@
+/* Receives VBAN audio streams and reports how well they are paced.
+ *
+ * Usage: vban-receiver [-p port] [-f] [-i interval] [-d duration] [-w file.wav] [-s stream]
+ *   -p port      UDP port to listen on (default 6980)
+ *   -f           also listen on port + 1 and rebuild lost packets from FEC parity
+ *   -i interval  seconds between reports (default 1)
+ *   -d duration  stop after this many seconds (default: until interrupted)
+ *   -w file.wav  write the decoded audio of one stream as 32-bit float WAV, PCM or the
+ *                sender's lossless formats. Packets are put in `nuFrame` order, those
+ *                lost or not decodable are written as silence of the same length
+ *   -s stream    stream name to write (default: the first stream received)
+ *
+ * For each stream (source address, port and stream name) the report lists packet
+ * rate, inter-arrival jitter percentiles relative to the nominal packet
+ * duration and the standard deviation of the inter-arrival time, `nuFrame`
+ * gaps, reorders and duplicates, packets rebuilt from FEC, packets of the written
+ * stream that could not be decoded, and format changes. To compare the pacing of
+ * the sender with and without SO_TXTIME, run the receiver on another host or
+ * network namespace so that the packets cross the egress qdisc.
+ * On Linux, packets are received in batches with recvmmsg and timestamped by
+ * the kernel. */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "vban.h"
+#include "vban_fec.h"
+#include "vban_lossless.h"
+
+#define BATCH_SIZE 64
+
+/* Packets this far behind the newest one are still told apart as filling a gap or duplicated. */
+#define MISSING_WINDOW 1024
+
+/* Packets of the WAV stream are held for this many `nuFrame` so that late and rebuilt packets
+ * are written in place, parity comes after the group at most. */
+#define WAV_REORDER_WINDOW (2 * VBAN_FEC_GROUP_MAX)
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(int)
+{
+	interrupted = 1;
+}
+
+static int64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct wav_writer
+{
+	FILE *fp = nullptr;
+	uint32_t n_channels = 0;
+	uint32_t sample_rate = 0;
+	uint64_t data_bytes = 0;
+
+	bool open(const char *path, uint32_t n_channels_, uint32_t sample_rate_)
+	{
+		fp = fopen(path, "wb");
+		if (!fp) {
+			fprintf(stderr, "Error: Failed to open '%s'. errno=%d\n", path, errno);
+			return false;
+		}
+		n_channels = n_channels_;
+		sample_rate = sample_rate_;
+		write_header();
+		return true;
+	}
+
+	void write_header()
+	{
+		const uint32_t block_align = n_channels * 4;
+		const uint32_t byte_rate = sample_rate * block_align;
+		const uint32_t data_size = (uint32_t)std::min<uint64_t>(data_bytes, UINT32_MAX - 36);
+		uint8_t h[44];
+		memcpy(h, "RIFF", 4);
+		put_le32(h + 4, 36 + data_size);
+		memcpy(h + 8, "WAVEfmt ", 8);
+		put_le32(h + 16, 16);
+		put_le16(h + 20, 3); /* WAVE_FORMAT_IEEE_FLOAT */
+		put_le16(h + 22, (uint16_t)n_channels);
+		put_le32(h + 24, sample_rate);
+		put_le32(h + 28, byte_rate);
+		put_le16(h + 32, (uint16_t)block_align);
+		put_le16(h + 34, 32);
+		memcpy(h + 36, "data", 4);
+		put_le32(h + 40, data_size);
+		fseek(fp, 0, SEEK_SET);
+		fwrite(h, sizeof(h), 1, fp);
+		fseek(fp, 0, SEEK_END);
+	}
+
+	void write(const float *samples, uint32_t n_samples)
+	{
+		fwrite(samples, sizeof(float), n_samples, fp);
+		data_bytes += sizeof(float) * n_samples;
+	}
+
+	void close()
+	{
+		if (!fp)
+			return;
+		write_header();
+		fclose(fp);
+		fp = nullptr;
+	}
+
+	static void put_le16(uint8_t *p, uint16_t v)
+	{
+		p[0] = v & 0xFF;
+		p[1] = v >> 8;
+	}
+
+	static void put_le32(uint8_t *p, uint32_t v)
+	{
+		for (int i = 0; i < 4; i++)
+			p[i] = (v >> (8 * i)) & 0xFF;
+	}
+};
+
+/* Unpacks `n_samples` two's complement values of `bits` bits written from the
+ * least significant bit of `src`, the layout of the sender's packed formats. */
+static void unpack_samples(const uint8_t *src, uint32_t n_samples, uint32_t bits, float *dst)
+{
+	const float scale = 1.0f / (float)(1u << (bits - 1));
+	uint64_t acc = 0;
+	uint32_t n_bits = 0;
+	for (uint32_t i = 0; i < n_samples; i++) {
+		while (n_bits < bits) {
+			acc |= (uint64_t)*src++ << n_bits;
+			n_bits += 8;
+		}
+		int32_t v = (int32_t)((uint32_t)acc << (32 - bits)) >> (32 - bits);
+		dst[i] = v * scale;
+		acc >>= bits;
+		n_bits -= bits;
+	}
+}
+
+/* Converts interleaved PCM samples of the VBAN bit format into float. Returns
+ * false if the format cannot be decoded. */
+static bool decode_samples(const uint8_t *src, uint32_t n_samples, uint8_t format_bit, float *dst)
+{
+	switch (format_bit & VBAN_BIT_RESOLUTION_MASK) {
+	case VBAN_BITFMT_8_INT:
+		for (uint32_t i = 0; i < n_samples; i++)
+			dst[i] = (int8_t)src[i] / 128.0f;
+		return true;
+	case VBAN_BITFMT_16_INT:
+		for (uint32_t i = 0; i < n_samples; i++)
+			dst[i] = (int16_t)(src[2 * i] | (src[2 * i + 1] << 8)) / 32768.0f;
+		return true;
+	case VBAN_BITFMT_24_INT:
+		for (uint32_t i = 0; i < n_samples; i++) {
+			const uint8_t *p = src + 3 * i;
+			int32_t v = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+			dst[i] = v / 8388608.0f;
+		}
+		return true;
+	case VBAN_BITFMT_32_INT:
+		for (uint32_t i = 0; i < n_samples; i++) {
+			int32_t v;
+			memcpy(&v, src + 4 * i, 4);
+			dst[i] = (float)(v / 2147483648.0);
+		}
+		return true;
+	case VBAN_BITFMT_32_FLOAT:
+		memcpy(dst, src, 4 * n_samples);
+		return true;
+	case VBAN_BITFMT_64_FLOAT:
+		for (uint32_t i = 0; i < n_samples; i++) {
+			double v;
+			memcpy(&v, src + 8 * i, 8);
+			dst[i] = (float)v;
+		}
+		return true;
+	case VBAN_BITFMT_12_INT:
+		unpack_samples(src, n_samples, 12, dst);
+		return true;
+	case VBAN_BITFMT_10_INT:
+		unpack_samples(src, n_samples, 10, dst);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Decompresses a packet of the sender's lossless formats into float. */
+static bool decode_lossless(const uint8_t *src, uint32_t size, uint32_t n_channels, uint32_t n_frames,
+			    uint8_t format_bit, float *dst)
+{
+	uint32_t bits;
+	switch (format_bit & VBAN_BIT_RESOLUTION_MASK) {
+	case VBAN_BITFMT_16_INT:
+		bits = 16;
+		break;
+	case VBAN_BITFMT_24_INT:
+		bits = 24;
+		break;
+	default:
+		return false;
+	}
+
+	static int32_t samples[256 * 256];
+	if (!vban_lossless_decode(src, size, n_channels, n_frames, bits, samples))
+		return false;
+
+	const float scale = 1.0f / (float)(1u << (bits - 1));
+	for (uint32_t i = 0; i < n_channels * n_frames; i++)
+		dst[i] = samples[i] * scale;
+	return true;
+}
+
+static uint32_t payload_bits_per_sample(uint8_t format_bit)
+{
+	uint32_t res = format_bit & VBAN_BIT_RESOLUTION_MASK;
+	switch (res) {
+	case VBAN_BITFMT_12_INT:
+		return 12;
+	case VBAN_BITFMT_10_INT:
+		return 10;
+	default:
+		return res < VBAN_BIT_RESOLUTION_MAX ? 8 * VBanBitResolutionSize[res] : 0;
+	}
+}
+
+struct stream_stats
+{
+	std::string name;
+
+	bool has_format = false;
+	uint8_t format_SR = 0;
+	uint8_t format_nbs = 0;
+	uint8_t format_nbc = 0;
+	uint8_t format_bit = 0;
+
+	bool has_frame = false;
+	uint32_t next_frame = 0;
+	int64_t last_arrival_ns = 0;
+	uint64_t missing[MISSING_WINDOW / 64] = {}; /* bit per `nuFrame % MISSING_WINDOW` not received yet */
+
+	inline bool is_missing(uint32_t frame) const
+	{
+		return missing[frame % MISSING_WINDOW / 64] >> (frame % 64) & 1;
+	}
+
+	inline void set_missing(uint32_t frame, bool v)
+	{
+		uint64_t &w = missing[frame % MISSING_WINDOW / 64];
+		w = v ? w | 1ULL << (frame % 64) : w & ~(1ULL << (frame % 64));
+	}
+
+	/* Counters for the current interval */
+	uint64_t n_packets = 0;
+	uint64_t n_bytes = 0;
+	uint64_t n_gaps = 0;
+	uint64_t n_missing = 0;
+	uint64_t n_reorders = 0;
+	uint64_t n_duplicates = 0;
+	uint64_t n_format_changes = 0;
+	uint64_t n_recovered = 0;
+	uint64_t n_undecodable = 0;
+	std::vector<int32_t> jitter_us; /* inter-arrival minus nominal packet duration */
+
+	/* Totals */
+	uint64_t total_packets = 0;
+	uint64_t total_missing = 0;
+	uint64_t total_reorders = 0;
+	uint64_t total_recovered = 0;
+	uint64_t total_undecodable = 0;
+
+	double packet_duration_us() const
+	{
+		uint32_t sr_index = format_SR & VBAN_SR_MASK;
+		if (sr_index >= VBAN_SR_MAXNUMBER)
+			return 0.0;
+		return (format_nbs + 1) * 1e6 / VBanSRList[sr_index];
+	}
+};
+
+struct receiver
+{
+	int fd = -1;
+	int fec_fd = -1;
+	std::map<std::string, stream_stats> streams;
+	std::map<std::string, vban_fec_decoder> decoders;
+
+	const char *wav_path = nullptr;
+	const char *wav_stream = nullptr;
+	std::string wav_key;
+	wav_writer wav;
+	std::vector<float> decoded;
+	std::map<uint32_t, std::vector<float>> wav_pending; /* decoded packets by `nuFrame` */
+	bool wav_has_frame = false;
+	uint32_t wav_next_frame = 0; /* `nuFrame` of the next packet to write */
+	uint64_t wav_silent_packets = 0;
+	uint64_t wav_late_packets = 0;
+	std::vector<float> silence;
+
+	void on_packet(const uint8_t *buf, uint32_t size, const struct sockaddr_in &from, int64_t arrival_ns,
+		       bool recovered);
+	void on_parity(const uint8_t *buf, uint32_t size, const struct sockaddr_in &from);
+	void report(double interval_sec);
+	void wav_queue(uint32_t nu_frame, const float *samples, uint32_t n_samples);
+	void wav_flush(bool all);
+};
+
+static std::string source_string(const struct sockaddr_in &from)
+{
+	char addr[INET_ADDRSTRLEN] = "";
+	inet_ntop(AF_INET, &from.sin_addr, addr, sizeof(addr));
+	return std::string(addr) + ":" + std::to_string(ntohs(from.sin_port));
+}
+
+static std::string stream_key(const VBanHeader &hdr, const struct sockaddr_in &from)
+{
+	char name[VBAN_STREAM_NAME_SIZE + 1] = {};
+	memcpy(name, hdr.streamname, VBAN_STREAM_NAME_SIZE);
+	return source_string(from) + "/" + name;
+}
+
+void receiver::on_packet(const uint8_t *buf, uint32_t size, const struct sockaddr_in &from, int64_t arrival_ns,
+			 bool recovered)
+{
+	if (size < VBAN_HEADER_SIZE || memcmp(buf, "VBAN", 4))
+		return;
+
+	VBanHeader hdr;
+	memcpy(&hdr, buf, VBAN_HEADER_SIZE);
+	if ((hdr.format_SR & VBAN_PROTOCOL_MASK) != VBAN_PROTOCOL_AUDIO)
+		return;
+
+	std::string key = stream_key(hdr, from);
+
+	if (!recovered && fec_fd >= 0) {
+		auto &dec = decoders[key];
+		if (!dec.add_data(buf, size))
+			return; /* already rebuilt from parity */
+	}
+
+	auto &st = streams[key];
+	if (st.name.empty()) {
+		char name[VBAN_STREAM_NAME_SIZE + 1] = {};
+		memcpy(name, hdr.streamname, VBAN_STREAM_NAME_SIZE);
+		st.name = name;
+	}
+
+	if (st.has_format && (st.format_SR != hdr.format_SR || st.format_nbs != hdr.format_nbs ||
+			      st.format_nbc != hdr.format_nbc || st.format_bit != hdr.format_bit))
+		st.n_format_changes++;
+	st.has_format = true;
+	st.format_SR = hdr.format_SR;
+	st.format_nbs = hdr.format_nbs;
+	st.format_nbc = hdr.format_nbc;
+	st.format_bit = hdr.format_bit;
+
+	st.n_packets++;
+	st.total_packets++;
+	st.n_bytes += size;
+	if (recovered) {
+		st.n_recovered++;
+		st.total_recovered++;
+	}
+
+	if (st.has_frame) {
+		int32_t diff = (int32_t)(hdr.nuFrame - st.next_frame);
+		if (diff > 0) {
+			st.n_gaps++;
+			st.n_missing += diff;
+			st.total_missing += diff;
+			for (uint32_t i = diff > MISSING_WINDOW ? diff - MISSING_WINDOW : 0; i < (uint32_t)diff; i++)
+				st.set_missing(st.next_frame + i, true);
+		} else if (diff < 0) {
+			if (diff >= -MISSING_WINDOW && st.is_missing(hdr.nuFrame)) {
+				/* A late or rebuilt packet fills a gap counted earlier. */
+				st.set_missing(hdr.nuFrame, false);
+				st.n_missing = st.n_missing ? st.n_missing - 1 : 0;
+				st.total_missing = st.total_missing ? st.total_missing - 1 : 0;
+				if (!recovered) {
+					st.n_reorders++;
+					st.total_reorders++;
+				}
+			} else if (!recovered && diff < -MISSING_WINDOW) {
+				st.n_reorders++;
+				st.total_reorders++;
+			} else if (!recovered) {
+				st.n_duplicates++;
+			}
+		}
+		if (diff >= 0) {
+			st.set_missing(hdr.nuFrame, false);
+			st.next_frame = hdr.nuFrame + 1;
+		}
+	} else {
+		st.has_frame = true;
+		st.next_frame = hdr.nuFrame + 1;
+	}
+
+	if (!recovered) {
+		if (st.last_arrival_ns) {
+			double interval_us = (arrival_ns - st.last_arrival_ns) * 1e-3;
+			st.jitter_us.push_back((int32_t)(interval_us - st.packet_duration_us()));
+		}
+		st.last_arrival_ns = arrival_ns;
+	}
+
+	if (!wav_path)
+		return;
+
+	if (wav_key.empty() && (!wav_stream || st.name == wav_stream)) {
+		uint32_t sr_index = hdr.format_SR & VBAN_SR_MASK;
+		if (sr_index < VBAN_SR_MAXNUMBER && wav.open(wav_path, hdr.format_nbc + 1, VBanSRList[sr_index]))
+			wav_key = key;
+		else
+			wav_path = nullptr;
+	}
+
+	if (key != wav_key)
+		return;
+
+	const uint32_t n_samples = (hdr.format_nbs + 1) * (hdr.format_nbc + 1);
+	if ((uint32_t)hdr.format_nbc + 1 != wav.n_channels) {
+		st.n_undecodable++;
+		st.total_undecodable++;
+		return;
+	}
+	decoded.resize(n_samples);
+
+	if ((hdr.format_bit & VBAN_CODEC_MASK) == VBAN_CODEC_USER) {
+		if (!decode_lossless(buf + VBAN_HEADER_SIZE, size - VBAN_HEADER_SIZE, hdr.format_nbc + 1,
+				     hdr.format_nbs + 1, hdr.format_bit, decoded.data())) {
+			st.n_undecodable++;
+			st.total_undecodable++;
+			return;
+		}
+		wav_queue(hdr.nuFrame, decoded.data(), n_samples);
+		return;
+	}
+
+	const uint32_t bits = payload_bits_per_sample(hdr.format_bit);
+	if ((hdr.format_bit & VBAN_CODEC_MASK) != VBAN_CODEC_PCM || !bits ||
+	    VBAN_HEADER_SIZE + (n_samples * bits + 7) / 8 > size) {
+		st.n_undecodable++;
+		st.total_undecodable++;
+		return;
+	}
+
+	decode_samples(buf + VBAN_HEADER_SIZE, n_samples, hdr.format_bit, decoded.data());
+	wav_queue(hdr.nuFrame, decoded.data(), n_samples);
+}
+
+void receiver::wav_queue(uint32_t nu_frame, const float *samples, uint32_t n_samples)
+{
+	const int32_t diff = (int32_t)(nu_frame - wav_next_frame);
+	if (!wav_has_frame || diff > MISSING_WINDOW || diff < -MISSING_WINDOW) {
+		/* The first packet, or the sender has restarted its `nuFrame`; the length of the
+		 * break is not known, nothing is inserted for it. */
+		wav_flush(true);
+		wav_has_frame = true;
+		wav_next_frame = nu_frame;
+	} else if (diff < 0) {
+		/* Too late, already written as silence */
+		wav_late_packets++;
+		return;
+	}
+
+	wav_pending[nu_frame].assign(samples, samples + n_samples);
+	wav_flush(false);
+}
+
+void receiver::wav_flush(bool all)
+{
+	while (!wav_pending.empty()) {
+		auto it = wav_pending.begin();
+		const uint32_t gap = it->first - wav_next_frame;
+		if (gap && !all && wav_pending.rbegin()->first - wav_next_frame < WAV_REORDER_WINDOW)
+			break;
+
+		/* The missing packets are taken to be as long as the one after them. */
+		const uint32_t n_samples = (uint32_t)it->second.size();
+		if (gap) {
+			silence.assign((size_t)gap * n_samples, 0.0f);
+			wav.write(silence.data(), (uint32_t)silence.size());
+			wav_silent_packets += gap;
+		}
+		wav.write(it->second.data(), n_samples);
+		wav_next_frame = it->first + 1;
+		wav_pending.erase(it);
+	}
+}
+
+void receiver::on_parity(const uint8_t *buf, uint32_t size, const struct sockaddr_in &from)
+{
+	if (size < VBAN_FEC_OVERHEAD || memcmp(buf, "VBAN", 4))
+		return;
+
+	VBanHeader hdr;
+	memcpy(&hdr, buf, VBAN_HEADER_SIZE);
+	std::string key = stream_key(hdr, from);
+
+	uint8_t recovered[VBAN_PROTOCOL_MAX_SIZE];
+	uint32_t n = decoders[key].add_parity(buf, size, recovered);
+	if (n)
+		on_packet(recovered, n, from, 0, true);
+}
+
+static double percentile(std::vector<int32_t> &v, double p)
+{
+	if (v.empty())
+		return 0.0;
+	size_t k = std::min(v.size() - 1, (size_t)(p * v.size()));
+	std::nth_element(v.begin(), v.begin() + k, v.end());
+	return v[k];
+}
+
+void receiver::report(double interval_sec)
+{
+	printf("%-28s %4s %6s %3s %9s %8s %7s %7s %7s %7s %7s %6s %6s %5s %5s %5s %5s\n", "stream", "ch", "rate",
+	       "fmt", "pkt/s", "kbit/s", "p50us", "p95us", "p99us", "maxus", "sdus", "gaps", "lost", "reord", "dup", "fec",
+	       "undec");
+
+	for (auto &[key, st] : streams) {
+		double sum = 0.0, sum2 = 0.0;
+		for (auto j : st.jitter_us) {
+			sum += j;
+			sum2 += (double)j * j;
+		}
+		size_t n = st.jitter_us.size();
+		double sd = n > 1 ? std::sqrt(std::max(0.0, (sum2 - sum * sum / n) / (n - 1))) : 0.0;
+
+		for (auto &j : st.jitter_us)
+			j = std::abs(j);
+		double p50 = percentile(st.jitter_us, 0.50);
+		double p95 = percentile(st.jitter_us, 0.95);
+		double p99 = percentile(st.jitter_us, 0.99);
+		double max = st.jitter_us.empty() ? 0.0 : *std::max_element(st.jitter_us.begin(), st.jitter_us.end());
+
+		uint32_t sr_index = st.format_SR & VBAN_SR_MASK;
+		long rate = sr_index < VBAN_SR_MAXNUMBER ? VBanSRList[sr_index] : 0;
+
+		printf("%-28s %4u %6ld %3u %9.1f %8.1f %7.0f %7.0f %7.0f %7.0f %7.1f %6llu %6llu %5llu %5llu %5llu "
+		       "%5llu%s\n",
+		       key.c_str(), st.format_nbc + 1, rate, st.format_bit, st.n_packets / interval_sec,
+		       st.n_bytes * 8e-3 / interval_sec, p50, p95, p99, max, sd, (unsigned long long)st.n_gaps,
+		       (unsigned long long)st.n_missing, (unsigned long long)st.n_reorders,
+		       (unsigned long long)st.n_duplicates, (unsigned long long)st.n_recovered,
+		       (unsigned long long)st.n_undecodable, st.n_format_changes ? " FORMAT CHANGED" : "");
+
+		st.n_packets = st.n_bytes = 0;
+		st.n_gaps = st.n_missing = st.n_reorders = st.n_duplicates = 0;
+		st.n_format_changes = st.n_recovered = st.n_undecodable = 0;
+		st.jitter_us.clear();
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+static int open_socket(uint16_t port)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0)
+		return -1;
+
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_TIMESTAMPNS
+	setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+#endif
+	int rcvbuf = 4 << 20;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Error: Failed to bind port %u. errno=%d\n", port, errno);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+struct recv_batch
+{
+	uint8_t buf[BATCH_SIZE][VBAN_PROTOCOL_MAX_SIZE];
+	struct sockaddr_in from[BATCH_SIZE];
+	uint32_t size[BATCH_SIZE];
+	int64_t arrival_ns[BATCH_SIZE];
+#ifdef __linux__
+	struct mmsghdr msgs[BATCH_SIZE];
+	struct iovec iov[BATCH_SIZE];
+	char control[BATCH_SIZE][64];
+#endif
+
+	/* Receives available packets without blocking and returns the count. */
+	int receive(int fd)
+	{
+#ifdef __linux__
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			iov[i].iov_base = buf[i];
+			iov[i].iov_len = sizeof(buf[i]);
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_name = &from[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = control[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+		}
+
+		int n = recvmmsg(fd, msgs, BATCH_SIZE, MSG_DONTWAIT, NULL);
+		if (n <= 0)
+			return 0;
+
+		int64_t fallback_ns = now_ns();
+		for (int i = 0; i < n; i++) {
+			size[i] = msgs[i].msg_len;
+			arrival_ns[i] = fallback_ns;
+			for (struct cmsghdr *c = CMSG_FIRSTHDR(&msgs[i].msg_hdr); c;
+			     c = CMSG_NXTHDR(&msgs[i].msg_hdr, c)) {
+				if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+					struct timespec ts;
+					memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+					arrival_ns[i] = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+				}
+			}
+		}
+		return n;
+#else
+		int n = 0;
+		for (; n < BATCH_SIZE; n++) {
+			socklen_t len = sizeof(from[n]);
+			ssize_t ret = recvfrom(fd, buf[n], sizeof(buf[n]), MSG_DONTWAIT, (struct sockaddr *)&from[n],
+					       &len);
+			if (ret < 0)
+				break;
+			size[n] = (uint32_t)ret;
+			arrival_ns[n] = now_ns();
+		}
+		return n;
+#endif
+	}
+};
+
+int main(int argc, char **argv)
+{
+	uint16_t port = 6980;
+	bool use_fec = false;
+	double interval = 1.0;
+	double duration = 0.0;
+	receiver rx;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:fi:d:w:s:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = (uint16_t)atoi(optarg);
+			break;
+		case 'f':
+			use_fec = true;
+			break;
+		case 'i':
+			interval = atof(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'w':
+			rx.wav_path = optarg;
+			break;
+		case 's':
+			rx.wav_stream = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-p port] [-f] [-i interval] [-d duration] [-w file.wav] [-s stream]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+
+	rx.fd = open_socket(port);
+	if (rx.fd < 0)
+		return 1;
+	if (use_fec) {
+		rx.fec_fd = open_socket(port + VBAN_FEC_PORT_OFFSET);
+		if (rx.fec_fd < 0)
+			return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	static recv_batch batch;
+	auto start = std::chrono::steady_clock::now();
+	auto next_report = start + std::chrono::duration<double>(interval);
+
+	while (!interrupted) {
+		struct pollfd pfd[2] = {{rx.fd, POLLIN, 0}, {rx.fec_fd, POLLIN, 0}};
+		poll(pfd, rx.fec_fd >= 0 ? 2 : 1, 100);
+
+		if (pfd[0].revents & POLLIN) {
+			int n;
+			while ((n = batch.receive(rx.fd)) > 0) {
+				for (int i = 0; i < n; i++)
+					rx.on_packet(batch.buf[i], batch.size[i], batch.from[i], batch.arrival_ns[i],
+						     false);
+				if (n < BATCH_SIZE)
+					break;
+			}
+		}
+
+		if (rx.fec_fd >= 0 && (pfd[1].revents & POLLIN)) {
+			int n = batch.receive(rx.fec_fd);
+			for (int i = 0; i < n; i++)
+				rx.on_parity(batch.buf[i], batch.size[i], batch.from[i]);
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if (now >= next_report) {
+			rx.report(interval);
+			next_report += std::chrono::duration<double>(interval);
+		}
+		if (duration > 0.0 && now - start >= std::chrono::duration<double>(duration))
+			break;
+	}
+
+	printf("Totals:\n");
+	for (auto &[key, st] : rx.streams)
+		printf("  %s: %llu packets, %llu lost, %llu reordered, %llu rebuilt from FEC, %llu not decodable\n",
+		       key.c_str(), (unsigned long long)st.total_packets, (unsigned long long)st.total_missing,
+		       (unsigned long long)st.total_reorders, (unsigned long long)st.total_recovered,
+		       (unsigned long long)st.total_undecodable);
+
+	if (!rx.wav_key.empty()) {
+		rx.wav_flush(true);
+		printf("  WAV %s: %llu packets written as silence, %llu too late to be written\n", rx.wav_key.c_str(),
+		       (unsigned long long)rx.wav_silent_packets, (unsigned long long)rx.wav_late_packets);
+	}
+	rx.wav.close();
+	close(rx.fd);
+	if (rx.fec_fd >= 0)
+		close(rx.fec_fd);
+
+	return 0;
+}
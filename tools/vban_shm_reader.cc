@@ -0,0 +1,183 @@
+/* Reference reader of the shared memory transport.
+ *
+ * Usage: vban-shm-reader [-p port] [-i interval] [-d duration] [-t poll_us] [-o file.raw]
+ *   -p port      port set on the plugin, which names the ring (default 6980)
+ *   -i interval  seconds between reports (default 1)
+ *   -d duration  stop after this many seconds (default: until interrupted)
+ *   -t poll_us   sleep between polls of the ring in microseconds (default 1000)
+ *   -o file.raw  write the payload of every packet, interleaved as on the wire
+ *
+ * The ring is received from the plugin over a unix socket and mapped read-only.
+ * Packets are used in place and checked afterwards that the plugin did not
+ * overwrite them meanwhile. The report lists the packet and frame rate, `nuFrame`
+ * gaps, packets lost because the reader fell behind the ring, and torn reads. */
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+
+#include "vban.h"
+#include "shm_transport.h"
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(int)
+{
+	interrupted = 1;
+}
+
+struct reader_stats
+{
+	uint64_t n_packets = 0;
+	uint64_t n_frames = 0;
+	uint64_t n_gaps = 0;
+	uint64_t n_overrun = 0;
+	uint64_t n_torn = 0;
+	uint64_t n_invalid = 0;
+};
+
+int main(int argc, char **argv)
+{
+	uint16_t port = 6980;
+	double interval = 1.0;
+	double duration = 0.0;
+	uint32_t poll_us = 1000;
+	const char *out_path = nullptr;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:i:d:t:o:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = (uint16_t)atoi(optarg);
+			break;
+		case 'i':
+			interval = atof(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 't':
+			poll_us = (uint32_t)atoi(optarg);
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-p port] [-i interval] [-d duration] [-t poll_us] [-o file.raw]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+
+	int fd = shm_transport_connect(port);
+	if (fd < 0) {
+		fprintf(stderr, "Error: No plugin publishes vban-shm-%u\n", port);
+		return 1;
+	}
+
+	shm_ring_reader ring;
+	if (!ring.attach(fd))
+		return 1;
+	close(fd);
+
+	FILE *out = nullptr;
+	if (out_path && !(out = fopen(out_path, "wb"))) {
+		fprintf(stderr, "Error: Cannot open %s\n", out_path);
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	reader_stats st, total;
+	bool has_nu_frame = false;
+	uint32_t next_nu_frame = 0;
+	uint64_t next = ring.write_index(); /* start from the live edge */
+
+	auto start = std::chrono::steady_clock::now();
+	auto next_report = start + std::chrono::duration<double>(interval);
+
+	printf("%9s %9s %6s %8s %6s %6s\n", "pkt/s", "frames/s", "gaps", "overrun", "torn", "bad");
+
+	while (!interrupted) {
+		uint64_t w = ring.write_index();
+
+		if (w - next > ring.n_slots()) {
+			/* The packets older than the ring have been overwritten. */
+			uint64_t oldest = w - ring.n_slots();
+			st.n_overrun += oldest - next;
+			next = oldest;
+		}
+
+		for (; next < w; next++) {
+			const uint8_t *packet;
+			uint32_t size;
+			shm_ring_status status = ring.peek(next, packet, size);
+			if (status == shm_ring_empty)
+				break;
+			if (status == shm_ring_overrun) {
+				st.n_overrun++;
+				continue;
+			}
+
+			VBanHeader hdr;
+			if (size < VBAN_HEADER_SIZE) {
+				st.n_invalid++;
+				continue;
+			}
+			memcpy(&hdr, packet, VBAN_HEADER_SIZE);
+			if (memcmp(&hdr.vban, "VBAN", 4) != 0) {
+				st.n_invalid++;
+				continue;
+			}
+
+			if (out)
+				fwrite(packet + VBAN_HEADER_SIZE, 1, size - VBAN_HEADER_SIZE, out);
+
+			if (!ring.still_valid(next)) {
+				st.n_torn++;
+				continue;
+			}
+
+			if (has_nu_frame && hdr.nuFrame != next_nu_frame)
+				st.n_gaps++;
+			has_nu_frame = true;
+			next_nu_frame = hdr.nuFrame + 1;
+
+			st.n_packets++;
+			st.n_frames += (uint32_t)hdr.format_nbs + 1;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if (now >= next_report) {
+			printf("%9.1f %9.0f %6llu %8llu %6llu %6llu\n", st.n_packets / interval, st.n_frames / interval,
+			       (unsigned long long)st.n_gaps, (unsigned long long)st.n_overrun,
+			       (unsigned long long)st.n_torn, (unsigned long long)st.n_invalid);
+			fflush(stdout);
+			total.n_packets += st.n_packets;
+			total.n_gaps += st.n_gaps;
+			total.n_overrun += st.n_overrun;
+			total.n_torn += st.n_torn;
+			st = reader_stats();
+			next_report += std::chrono::duration<double>(interval);
+		}
+		if (duration > 0.0 && now - start >= std::chrono::duration<double>(duration))
+			break;
+
+		if (next == ring.write_index())
+			std::this_thread::sleep_for(std::chrono::microseconds(poll_us));
+	}
+
+	printf("Total: %llu packets, %llu gaps, %llu overrun, %llu torn\n", (unsigned long long)total.n_packets,
+	       (unsigned long long)total.n_gaps, (unsigned long long)total.n_overrun,
+	       (unsigned long long)total.n_torn);
+
+	if (out)
+		fclose(out);
+
+	return 0;
+}